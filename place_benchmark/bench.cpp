@@ -0,0 +1,656 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include <inttypes.h>
+
+#include "../place_core/allocation_counter.h"
+#include "../place_core/canvas_format.h"
+#include "../place_core/frame_writer.h"
+#include "../place_core/synthetic_archive.h"
+#include "../place_core/timeline_cursor.h"
+#include "../place_core/latency_histogram.h"
+#include "../place_core/paged_timeline.h"
+#include "../place_core/stage_trace.h"
+
+// named measurements of one run, printed as they come in and saved as one json object
+class BenchResults
+{
+public:
+	void SetInfo(const std::string& key, const std::string& value)
+	{
+		m_Info.emplace_back(key, value);
+	}
+
+	void Add(const std::string& key, double value, const char* unit)
+	{
+		m_Metrics.emplace_back(key, value);
+		std::cout << "  " << key << ": " << value << " " << unit << std::endl;
+	}
+
+	bool Save(const std::string& path) const
+	{
+		std::ofstream json_file(path, std::ios::out | std::ios::trunc);
+		if (!json_file.is_open())
+			return false;
+
+		json_file << "{" << std::endl;
+		for (const auto& info : m_Info)
+			json_file << "\t\"" << info.first << "\": \"" << Escape(info.second) << "\"," << std::endl;
+
+		json_file << "\t\"metrics\": {" << std::endl;
+		json_file.precision(17);
+		for (size_t i = 0; i < m_Metrics.size(); ++i)
+			json_file << "\t\t\"" << m_Metrics[i].first << "\": " << m_Metrics[i].second << (i + 1 < m_Metrics.size() ? "," : "") << std::endl;
+		json_file << "\t}" << std::endl << "}" << std::endl;
+		return json_file.good();
+	}
+
+private:
+	static std::string Escape(const std::string& text)
+	{
+		std::string escaped;
+		for (const char c : text)
+		{
+			if (c == '"' || c == '\\')
+				escaped += '\\';
+			escaped += c;
+		}
+		return escaped;
+	}
+
+	std::vector<std::pair<std::string, std::string>>	m_Info;
+	std::vector<std::pair<std::string, double>>			m_Metrics;
+};
+
+double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// median of the run times, so one slow run from a busy machine does not skew the result
+double median_ms(std::vector<double> run_ms)
+{
+	std::sort(run_ms.begin(), run_ms.end());
+	return run_ms[run_ms.size() / 2];
+}
+
+double per_second(double count, double ms)
+{
+	return ms > 0.0 ? count * 1000.0 / ms : 0.0;
+}
+
+// the 2017 palette followed by colors of the 2022 one, for synthetic archives with more than 16 colors
+static const uint32_t extended_palette[] =
+{
+	0x6D001A, 0xBE0039, 0xFF4500, 0xFFA800, 0xFFD635, 0xFFF8B8, 0x00A368, 0x00CC78,
+	0x7EED56, 0x00756F, 0x009EAA, 0x00CCC0, 0x2450A4, 0x3690EA, 0x51E9F4, 0x493AC1
+};
+
+// streams a synthetic archive to path, plus its sidecar unless it is drawn like the 2017 canvas,
+// and prints how long it took
+bool write_synthetic_archive(const std::string& path, const SyntheticArchiveOptions& options)
+{
+	CanvasFormat format;
+	format.width = static_cast<int32_t>(options.width);
+	format.height = static_cast<int32_t>(options.height);
+	for (uint32_t i = 0; format.ColorCount() < options.color_count && i < sizeof(extended_palette) / sizeof(extended_palette[0]); ++i)
+		format.palette.push_back(BitMapColor::FromRgb(extended_palette[i]));
+
+	std::remove(CanvasFormat::SidecarPath(path).c_str());
+	if (!format.IsDefault() && !format.Save(CanvasFormat::SidecarPath(path)))
+	{
+		std::cout << "Failed to write " << CanvasFormat::SidecarPath(path) << std::endl;
+		return false;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	SyntheticArchiveGenerator generator(options);
+	if (!generator.Write(path))
+	{
+		std::cout << "Failed to write the synthetic archive!" << std::endl;
+		return false;
+	}
+
+	const double ms = elapsed_ms(start);
+	std::cout << "synthetic archive: " << options.record_count << " records, " << generator.StepCount() << " steps on "
+		<< options.width << "x" << options.height << ", " << generator.BytesWritten() / (1024.0 * 1024.0) << " MB in "
+		<< ms << " ms (" << per_second(generator.BytesWritten() / (1024.0 * 1024.0), ms) << " MB/s)" << std::endl;
+	return true;
+}
+
+// opens, validates and indexes the archive run_count times with the given loader and thread count
+bool bench_load(const std::string& diffs_path, const CanvasFormat& format, DiffArchive::LoadMode mode, uint32_t thread_count, const char* key,
+	uint32_t run_count, BenchResults& results)
+{
+	std::vector<double> run_ms;
+	std::vector<double> validate_ms;
+	uint64_t record_count = 0;
+	uint64_t file_bytes = 0;
+	for (uint32_t run = 0; run < run_count; ++run)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		DiffArchive archive;
+		DiffTimeline timeline;
+		if (!archive.Open(diffs_path, mode, thread_count))
+			return false;
+		archive.Validate(format.width, format.height, format.ColorCount(), thread_count);
+		if (!timeline.Build(archive, thread_count))
+			return false;
+		run_ms.push_back(elapsed_ms(start));
+		validate_ms.push_back(archive.Stats().validate_ms);
+		record_count = archive.Count();
+		file_bytes = archive.Stats().file_bytes;
+	}
+
+	const double ms = median_ms(run_ms);
+	results.Add(std::string(key) + "_records_per_s", per_second(static_cast<double>(record_count), ms), "records/s");
+	results.Add(std::string(key) + "_bytes_per_s", per_second(static_cast<double>(file_bytes), ms), "bytes/s");
+	results.Add(std::string(key) + "_validate_ms", median_ms(validate_ms), "ms");
+	return true;
+}
+
+// replays the whole timeline onto a bare canvas and through the bitmap, which also patches the encoded frame
+template <uint32_t ColorCount>
+void bench_apply(const DiffTimeline& timeline, const CanvasFormat& format, uint32_t run_count, BenchResults& results)
+{
+	std::vector<double> canvas_ms;
+	std::vector<double> bitmap_ms;
+	for (uint32_t run = 0; run < run_count; ++run)
+	{
+		PlaceCanvasT<ColorCount> canvas(format.width, format.height);
+		auto start = std::chrono::steady_clock::now();
+		for (uint64_t step = 0; step < timeline.StepCount(); ++step)
+			canvas.Apply(timeline.Step(step));
+		canvas_ms.push_back(elapsed_ms(start));
+
+		BitMapCoreT<ColorCount> bitmap(format.width, format.height);
+		start = std::chrono::steady_clock::now();
+		for (uint64_t step = 0; step < timeline.StepCount(); ++step)
+			bitmap.Update(timeline.Step(step));
+		bitmap_ms.push_back(elapsed_ms(start));
+	}
+
+	const double records = static_cast<double>(timeline.RecordCount());
+	results.Add("apply_diffs_per_s", per_second(records, median_ms(canvas_ms)), "diffs/s");
+	results.Add("update_diffs_per_s", per_second(records, median_ms(bitmap_ms)), "diffs/s");
+	results.Add("update_frames_per_s", per_second(static_cast<double>(timeline.StepCount()), median_ms(bitmap_ms)), "frames/s");
+}
+
+// the densest parts of the timeline applied as they come and sorted by row first (see StepSorter):
+// the largest 1% of the steps one by one, and the busiest window of 1000 steps as one range the way
+// a forward seek or a keyframe build applies it. false if the two ways draw different frames
+template <uint32_t ColorCount>
+bool bench_batch(const DiffTimeline& timeline, const CanvasFormat& format, uint32_t run_count, BenchResults& results)
+{
+	if (timeline.StepCount() == 0)
+		return true;
+
+	const std::vector<uint64_t>& offsets = timeline.StepOffsets();
+	std::vector<uint64_t> dense_steps(static_cast<size_t>(timeline.StepCount()));
+	for (uint64_t step = 0; step < timeline.StepCount(); ++step)
+		dense_steps[step] = step;
+	const size_t dense_count = (std::max)(dense_steps.size() / 100, static_cast<size_t>(1));
+	std::nth_element(dense_steps.begin(), dense_steps.begin() + dense_count - 1, dense_steps.end(), [&offsets](uint64_t a, uint64_t b)
+		{ return offsets[a + 1] - offsets[a] > offsets[b + 1] - offsets[b]; });
+	dense_steps.resize(dense_count);
+	std::sort(dense_steps.begin(), dense_steps.end());
+
+	const uint64_t window = (std::min)(static_cast<uint64_t>(1000), timeline.StepCount());
+	uint64_t window_start = 0;
+	for (uint64_t step = 1; step + window <= timeline.StepCount(); ++step)
+	{
+		if (offsets[step + window] - offsets[step] > offsets[window_start + window] - offsets[window_start])
+			window_start = step;
+	}
+	const DiffStep range(timeline.Records() + offsets[window_start], timeline.Records() + offsets[window_start + window]);
+
+	uint64_t step_records = 0;
+	for (const uint64_t step : dense_steps)
+		step_records += offsets[step + 1] - offsets[step];
+
+	std::vector<double> update_steps_ms;
+	std::vector<double> sorted_steps_ms;
+	std::vector<double> update_range_ms;
+	std::vector<double> sorted_range_ms;
+	bool same = true;
+	bool sorted_by_default = false;
+	for (uint32_t run = 0; run < run_count; ++run)
+	{
+		BitMapCoreT<ColorCount> unsorted(format.width, format.height);
+		unsorted.SetBatchThreshold(SIZE_MAX);
+		BitMapCoreT<ColorCount> sorted(format.width, format.height);
+		sorted_by_default = sorted.BatchThreshold() != SIZE_MAX;
+		sorted.SetBatchThreshold(0);
+
+		auto start = std::chrono::steady_clock::now();
+		for (const uint64_t step : dense_steps)
+			unsorted.Update(timeline.Step(step));
+		update_steps_ms.push_back(elapsed_ms(start));
+
+		start = std::chrono::steady_clock::now();
+		for (const uint64_t step : dense_steps)
+			sorted.Update(timeline.Step(step));
+		sorted_steps_ms.push_back(elapsed_ms(start));
+		same = same && unsorted.GenerateBMPData() == sorted.GenerateBMPData();
+
+		start = std::chrono::steady_clock::now();
+		for (uint64_t step = window_start; step < window_start + window; ++step)
+			unsorted.Update(timeline.Step(step));
+		update_range_ms.push_back(elapsed_ms(start));
+
+		start = std::chrono::steady_clock::now();
+		sorted.Update(range);
+		sorted_range_ms.push_back(elapsed_ms(start));
+		same = same && unsorted.GenerateBMPData() == sorted.GenerateBMPData();
+	}
+
+	std::cout << "  largest 1% of steps (" << dense_count << "): " << step_records << " records, busiest window of " << window << " steps: "
+		<< range.size() << " records, " << (sorted_by_default ? "sorted" : "applied as they come") << " by default" << std::endl;
+	results.Add("dense_steps_update_diffs_per_s", per_second(static_cast<double>(step_records), median_ms(update_steps_ms)), "diffs/s");
+	results.Add("dense_steps_sorted_diffs_per_s", per_second(static_cast<double>(step_records), median_ms(sorted_steps_ms)), "diffs/s");
+	results.Add("dense_range_update_diffs_per_s", per_second(static_cast<double>(range.size()), median_ms(update_range_ms)), "diffs/s");
+	results.Add("dense_range_sorted_diffs_per_s", per_second(static_cast<double>(range.size()), median_ms(sorted_range_ms)), "diffs/s");
+	return same;
+}
+
+// encodes the final canvas from scratch frame_count times, what every keyframe restore pays
+template <uint32_t ColorCount>
+void bench_encode(const DiffTimeline& timeline, const CanvasFormat& format, uint32_t frame_count, uint32_t run_count, BenchResults& results)
+{
+	PlaceCanvasT<ColorCount> canvas(format.width, format.height);
+	for (uint64_t step = 0; step < timeline.StepCount(); ++step)
+		canvas.Apply(timeline.Step(step));
+
+	BitMapCoreT<ColorCount> bitmap(format.width, format.height);
+	bitmap.SetPalette(format.palette);
+	std::vector<double> run_ms;
+	for (uint32_t run = 0; run < run_count; ++run)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		for (uint32_t frame = 0; frame < frame_count; ++frame)
+			bitmap.SetCanvas(canvas);
+		run_ms.push_back(elapsed_ms(start));
+	}
+
+	results.Add("encode_frames_per_s", per_second(frame_count, median_ms(run_ms)), "frames/s");
+}
+
+std::string bench_frame_path(uint32_t frame)
+{
+	return "bench_frame_" + std::to_string(frame) + ".bmp";
+}
+
+// writes frame_count frames of the first steps to disk and removes them again
+template <uint32_t ColorCount>
+bool bench_write(const DiffTimeline& timeline, const CanvasFormat& format, uint32_t frame_count, BenchResults& results)
+{
+	BitMapCoreT<ColorCount> bitmap(format.width, format.height);
+	bitmap.SetPalette(format.palette);
+	uint64_t bytes = 0;
+	const auto start = std::chrono::steady_clock::now();
+	for (uint32_t frame = 0; frame < frame_count; ++frame)
+	{
+		if (frame < timeline.StepCount())
+			bitmap.Update(timeline.Step(frame));
+		if (!bitmap.Write(bench_frame_path(frame)))
+			return false;
+		bytes += bitmap.GenerateBMPData().size();
+	}
+	const double ms = elapsed_ms(start);
+
+	for (uint32_t frame = 0; frame < frame_count; ++frame)
+		std::remove(bench_frame_path(frame).c_str());
+
+	results.Add("write_bytes_per_s", per_second(static_cast<double>(bytes), ms), "bytes/s");
+	results.Add("write_frames_per_s", per_second(frame_count, ms), "frames/s");
+	return true;
+}
+
+// random seeks and short scrubs through the cursor, the way the gui's trackbar moves it
+template <uint32_t ColorCount>
+void bench_seek(const DiffTimeline& timeline, const CanvasFormat& format, uint32_t seek_count, BenchResults& results)
+{
+	KeyframeStoreT<ColorCount> keyframes;
+	keyframes.Build(timeline, format.width, format.height);
+	UndoStreamT<ColorCount> undo;
+	undo.Build(timeline, format.width, format.height);
+	BitMapCoreT<ColorCount> bitmap(format.width, format.height);
+	bitmap.SetPalette(format.palette);
+	TimelineCursorT<ColorCount> cursor(timeline, keyframes, undo, bitmap);
+
+	std::mt19937_64 rng(1);
+	std::uniform_int_distribution<uint64_t> pick_step(0, timeline.StepCount());
+	LatencyHistogram seeks;
+	for (uint32_t i = 0; i < seek_count; ++i)
+	{
+		const uint64_t target = pick_step(rng);
+		const auto start = std::chrono::steady_clock::now();
+		cursor.SeekTo(target);
+		seeks.Record(elapsed_ms(start));
+	}
+
+	std::uniform_int_distribution<int> pick_offset(-10, 10);
+	LatencyHistogram scrubs;
+	for (uint32_t i = 0; i < seek_count; ++i)
+	{
+		const int offset = pick_offset(rng);
+		const uint64_t target = (offset < 0 && cursor.AppliedSteps() < static_cast<uint64_t>(-offset)) ? 0 : cursor.AppliedSteps() + offset;
+		const auto start = std::chrono::steady_clock::now();
+		cursor.SeekTo(target);
+		scrubs.Record(elapsed_ms(start));
+	}
+
+	results.Add("seek_p50_ms", seeks.Percentile(50.0), "ms");
+	results.Add("seek_p99_ms", seeks.Percentile(99.0), "ms");
+	results.Add("scrub_p50_ms", scrubs.Percentile(50.0), "ms");
+	results.Add("scrub_p99_ms", scrubs.Percentile(99.0), "ms");
+}
+
+// scrubbing through the cursor and exporting through the frame writer must not allocate once
+// every buffer is in use. counts the allocations of both after a warm up, false if there were any
+template <uint32_t ColorCount>
+bool bench_allocations(const DiffTimeline& timeline, const CanvasFormat& format, uint32_t frame_count, uint32_t seek_count, BenchResults& results)
+{
+	KeyframeStoreT<ColorCount> keyframes;
+	keyframes.Build(timeline, format.width, format.height);
+	UndoStreamT<ColorCount> undo;
+	undo.Build(timeline, format.width, format.height);
+	BitMapCoreT<ColorCount> bitmap(format.width, format.height);
+	bitmap.SetPalette(format.palette);
+	bitmap.EnablePyramid();
+	TimelineCursorT<ColorCount> cursor(timeline, keyframes, undo, bitmap);
+
+	std::mt19937_64 rng(2);
+	std::uniform_int_distribution<uint64_t> pick_step(0, timeline.StepCount());
+	uint64_t checksum = 0;
+	for (uint32_t i = 0; i < seek_count; ++i)
+	{
+		cursor.SeekTo(pick_step(rng));
+		checksum += bitmap.GenerateBMPData(i % MipPyramid::level_count).size();
+	}
+
+	uint64_t allocations = allocation_counter::Count();
+	for (uint32_t i = 0; i < seek_count; ++i)
+	{
+		cursor.SeekTo(pick_step(rng));
+		checksum += bitmap.GenerateBMPData(i % MipPyramid::level_count).size();
+	}
+	const uint64_t scrub_allocations = allocation_counter::Count() - allocations;
+
+	// every buffer is sized for the frames up front, since a fast writer may keep handing back the
+	// same one and leave the rest untouched by the warm up. then the same frames again, written
+	// directly the way --writers 0 does
+	static const uint32_t writer_count = 2;
+	static const uint32_t buffer_count = 4;
+	const uint32_t warm_frames = 2 * buffer_count;
+	BitMapCoreT<ColorCount> frame(format.width, format.height);
+	frame.SetPalette(format.palette);
+	std::string name;
+	uint64_t export_allocations = 0;
+	{
+		FrameWriter writer(writer_count, buffer_count);
+		writer.Reserve(frame.GenerateBMPData().size(), bench_frame_path(buffer_count).size());
+		for (uint32_t i = 0; i < warm_frames + frame_count; ++i)
+		{
+			if (i == warm_frames)
+				allocations = allocation_counter::Count();
+			if (i < timeline.StepCount())
+				frame.Update(timeline.Step(i));
+			frame.SetName(name.assign("bench_frame_").append(std::to_string(i % buffer_count)));
+			writer.Write(frame.Name(), frame.GenerateBMPData());
+		}
+		writer.Close();
+		export_allocations = allocation_counter::Count() - allocations;
+	}
+
+	allocations = allocation_counter::Count();
+	for (uint32_t i = 0; i < frame_count; ++i)
+	{
+		frame.SetName(name.assign("bench_frame_").append(std::to_string(i % buffer_count)));
+		frame.Write();
+	}
+	export_allocations += allocation_counter::Count() - allocations;
+
+	for (uint32_t i = 0; i < buffer_count; ++i)
+		std::remove(bench_frame_path(i).c_str());
+
+	results.Add("scrub_allocations", static_cast<double>(scrub_allocations), "allocations");
+	results.Add("export_allocations", static_cast<double>(export_allocations), "allocations");
+	return checksum > 0 && scrub_allocations == 0 && export_allocations == 0;
+}
+
+// replays the archive off the disk and seeks through it with the paged timeline, once per budget with
+// a cold page cache. the peak rss of each run covers the whole process, reset between budgets on linux.
+// false if a read failed or the replay and a restore of the last step drew different canvases
+template <uint32_t ColorCount>
+bool bench_paged(const std::string& diffs_path, const CanvasFormat& format, const std::vector<uint64_t>& budget_mbs, uint32_t seek_count, BenchResults& results)
+{
+	for (const uint64_t budget_mb : budget_mbs)
+	{
+		const std::string key = "paged_" + std::to_string(budget_mb) + "mb";
+		DiffArchive::DropPageCache(diffs_path);
+		stage_trace::ResetPeakRss();
+
+		PagedTimelinePolicy policy;
+		policy.memory_budget = budget_mb * 1024 * 1024;
+		PagedTimelineT<ColorCount> paged;
+		if (!paged.Open(diffs_path, format.width, format.height, format.ColorCount(), policy))
+		{
+			std::cout << "  skipped, the paged timeline reads raw archives only" << std::endl;
+			return true;
+		}
+
+		PlaceCanvasT<ColorCount> canvas(format.width, format.height);
+		const auto start = std::chrono::steady_clock::now();
+		for (uint64_t step = 0; step < paged.StepCount(); ++step)
+			canvas.Apply(paged.Step(step));
+		const double replay_ms = elapsed_ms(start);
+
+		std::mt19937_64 rng(1);
+		std::uniform_int_distribution<uint64_t> pick_step(0, paged.StepCount());
+		PlaceCanvasT<ColorCount> restored(format.width, format.height);
+		LatencyHistogram seeks;
+		for (uint32_t i = 0; i < seek_count; ++i)
+		{
+			const uint64_t target = pick_step(rng);
+			const auto seek_start = std::chrono::steady_clock::now();
+			paged.Restore(target, restored);
+			seeks.Record(elapsed_ms(seek_start));
+		}
+
+		if (!paged.Restore(paged.StepCount(), restored) || paged.Failed()
+			|| !std::equal(canvas.Data(), canvas.Data() + canvas.SizeBytes(), restored.Data()))
+			return false;
+
+		results.Add(key + "_scan_ms", paged.Stats().scan_ms, "ms");
+		results.Add(key + "_replay_diffs_per_s", per_second(static_cast<double>(paged.RecordCount()), replay_ms), "diffs/s");
+		results.Add(key + "_seek_p50_ms", seeks.Percentile(50.0), "ms");
+		results.Add(key + "_keyframe_slots", static_cast<double>(paged.Stats().keyframe_slots), "keyframes");
+		results.Add(key + "_resident_bytes", static_cast<double>(paged.MemoryBytes()), "bytes");
+		results.Add(key + "_peak_rss_bytes", static_cast<double>(stage_trace::PeakRssBytes()), "bytes");
+	}
+	return true;
+}
+
+template <uint32_t ColorCount>
+bool bench_timeline(const DiffTimeline& timeline, const CanvasFormat& format, uint32_t run_count, uint32_t frame_count, uint32_t seek_count, BenchResults& results)
+{
+	std::cout << "apply" << std::endl;
+	bench_apply<ColorCount>(timeline, format, run_count, results);
+
+	std::cout << "batch" << std::endl;
+	if (!bench_batch<ColorCount>(timeline, format, run_count, results))
+	{
+		std::cout << "Sorted batches drew a different frame than the steps applied in order!" << std::endl;
+		return false;
+	}
+
+	std::cout << "encode" << std::endl;
+	bench_encode<ColorCount>(timeline, format, frame_count, run_count, results);
+
+	std::cout << "write" << std::endl;
+	if (!bench_write<ColorCount>(timeline, format, frame_count, results))
+		std::cout << "Failed to write the benchmark frames!" << std::endl;
+
+	std::cout << "seek" << std::endl;
+	bench_seek<ColorCount>(timeline, format, seek_count, results);
+
+	std::cout << "steady state allocations" << std::endl;
+	if (!bench_allocations<ColorCount>(timeline, format, frame_count, seek_count, results))
+	{
+		std::cout << "Scrubbing or exporting allocated after warming up!" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	std::string diffs_path = "diffs.bin";
+	std::string json_path = "bench_results.json";
+	std::string generate_path;
+	bool synthetic = false;
+	SyntheticArchiveOptions synthetic_options;
+	uint32_t run_count = 3;
+	uint32_t frame_count = 200;
+	uint32_t seek_count = 1000;
+	std::vector<uint64_t> budget_mbs = { 16, 64, 256 };
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		if (arg == "--synthetic" && i + 1 < argc)
+		{
+			synthetic = true;
+			synthetic_options.record_count = std::stoull(argv[++i]);
+		}
+		else if (arg == "--generate" && i + 1 < argc)
+			generate_path = argv[++i];
+		else if (arg == "--size" && i + 2 < argc)
+		{
+			synthetic_options.width = static_cast<uint32_t>(std::stoul(argv[++i]));
+			synthetic_options.height = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (arg == "--density" && i + 1 < argc)
+			synthetic_options.records_per_second = std::stod(argv[++i]);
+		else if (arg == "--hotspots" && i + 1 < argc)
+			synthetic_options.hotspot_count = static_cast<uint32_t>(std::stoul(argv[++i]));
+		else if (arg == "--hotspot-share" && i + 1 < argc)
+			synthetic_options.hotspot_share = std::stod(argv[++i]);
+		else if (arg == "--hotspot-radius" && i + 1 < argc)
+			synthetic_options.hotspot_radius = std::stod(argv[++i]);
+		else if (arg == "--colors" && i + 1 < argc)
+			synthetic_options.color_count = static_cast<uint32_t>(std::stoul(argv[++i]));
+		else if (arg == "--seed" && i + 1 < argc)
+			synthetic_options.seed = static_cast<uint32_t>(std::stoul(argv[++i]));
+		else if (arg == "--json" && i + 1 < argc)
+			json_path = argv[++i];
+		else if (arg == "--runs" && i + 1 < argc)
+			run_count = (std::max)(static_cast<uint32_t>(std::stoul(argv[++i])), 1u);
+		else if (arg == "--frames" && i + 1 < argc)
+			frame_count = (std::max)(static_cast<uint32_t>(std::stoul(argv[++i])), 1u);
+		else if (arg == "--seeks" && i + 1 < argc)
+			seek_count = (std::max)(static_cast<uint32_t>(std::stoul(argv[++i])), 1u);
+		else if (arg == "--budgets" && i + 1 < argc)
+		{
+			budget_mbs.clear();
+			const std::string list = argv[++i];
+			for (size_t first = 0, comma = 0; comma != std::string::npos; first = comma + 1)
+			{
+				comma = list.find(',', first);
+				budget_mbs.push_back((std::max)(std::stoull(list.substr(first, comma - first)), 1ull));
+			}
+			std::sort(budget_mbs.begin(), budget_mbs.end());
+		}
+		else
+			diffs_path = arg;
+	}
+
+	// --generate only writes the archive, --synthetic benchmarks it and removes it again
+	if (!generate_path.empty())
+		return write_synthetic_archive(generate_path, synthetic_options) ? 0 : 1;
+
+	if (synthetic)
+	{
+		diffs_path = "bench_synthetic.bin";
+		if (!write_synthetic_archive(diffs_path, synthetic_options))
+			return 1;
+	}
+
+	BenchResults results;
+	results.SetInfo("archive", synthetic ? "synthetic" : diffs_path);
+	results.SetInfo("kernel", bmp_expand::Name(bmp_expand::Best()));
+
+	CanvasFormat format;
+	if (!format.Load(diffs_path) || format.ColorCount() > CanvasFormat::max_colors)
+	{
+		std::cout << "Failed to read " << CanvasFormat::SidecarPath(diffs_path) << std::endl;
+		return 1;
+	}
+
+	// before anything loads the whole archive, so the first budget's peak rss is its own where it can't be reset
+	bool paged = true;
+	std::cout << "paged (cold, " << (std::max)(seek_count / 50, 1u) << " seeks per budget)" << std::endl;
+	WithPaletteSize(format.ColorCount(), [&](auto palette_size)
+	{
+		paged = bench_paged<decltype(palette_size)::value>(diffs_path, format, budget_mbs, (std::max)(seek_count / 50, 1u), results);
+	});
+	if (!paged)
+	{
+		std::cout << "The paged timeline failed to read the archive or drew a different canvas than the replay!" << std::endl;
+		return 1;
+	}
+
+	std::cout << "load (median of " << run_count << " warm runs)" << std::endl;
+	if (!bench_load(diffs_path, format, DiffArchive::LoadMode::Mapped, 1, "load_mapped", run_count, results)
+		|| !bench_load(diffs_path, format, DiffArchive::LoadMode::Buffered, 1, "load_buffered", run_count, results)
+		|| !bench_load(diffs_path, format, DiffArchive::LoadMode::Mapped, 0, "load_mapped_parallel", run_count, results)
+		|| !bench_load(diffs_path, format, DiffArchive::LoadMode::Buffered, 0, "load_buffered_parallel", run_count, results))
+	{
+		std::cout << "Failed to open diffs file!" << std::endl;
+		return 1;
+	}
+
+	DiffArchive archive;
+	DiffTimeline timeline;
+	if (archive.Open(diffs_path))
+		archive.Validate(format.width, format.height, format.ColorCount());
+	if (!archive.IsValidated() || !timeline.Build(archive))
+	{
+		std::cout << "Failed to open diffs file!" << std::endl;
+		return 1;
+	}
+	results.SetInfo("records", std::to_string(timeline.RecordCount()));
+	results.SetInfo("steps", std::to_string(timeline.StepCount()));
+	results.SetInfo("canvas", std::to_string(format.width) + "x" + std::to_string(format.height));
+	results.SetInfo("colors", std::to_string(format.ColorCount()));
+
+	bool steady = true;
+	WithPaletteSize(format.ColorCount(), [&](auto palette_size)
+	{
+		steady = bench_timeline<decltype(palette_size)::value>(timeline, format, run_count, frame_count, seek_count, results);
+	});
+
+	archive.Close();
+	if (synthetic)
+	{
+		std::remove(diffs_path.c_str());
+		std::remove(CanvasFormat::SidecarPath(diffs_path).c_str());
+	}
+
+	if (!results.Save(json_path))
+	{
+		std::cout << "Failed to write " << json_path << "!" << std::endl;
+		return 1;
+	}
+	std::cout << "results written to " << json_path << std::endl;
+	return steady ? 0 : 1;
+}
@@ -1,397 +1,998 @@
 #include <algorithm>
+#include <atomic>
 #include <string>
 #include <fstream>
 #include <ostream>
 #include <iostream>
 #include <vector>
+#include <chrono>
+#include <memory>
+#include <random>
 #include <inttypes.h>
-#include <Windows.h>
 #include <assert.h>
-
-enum DiffColor
-{
-	White = 0,	// #FFFFFF	
-	Gray10 = 1,	// #E4E4E4	
-	Gray50 = 2,	// #888888	
-	Gray90 = 3,	// #222222	
-	Pink = 4,	// #FFA7D1	
-	Red = 5,	// #E50000	
-	Orange = 6,	// #E59500	
-	DarkOrange = 7,	// #A06A42	
-	Yellow = 8,	// #E5D900	
-	LimeGreen = 9,	// #94E044	
-	Green = 10,	// #02BE01	
-	LightBlue = 11,	// #00D3DD	
-	MediumBlue = 12,	// #0083C7	
-	Blue = 13,	// #0000EA	
-	LightPurle = 14,	// #CF6EE4	
-	Purple = 15	// #820080	
-};
-
-class PlaceDiff
+#include <cstdlib>
+#include <new>
+
+#include "../place_core/activity_map.h"
+#include "../place_core/allocation_counter.h"
+#include "../place_core/canvas_format.h"
+#include "../place_core/frame_writer.h"
+#include "../place_core/pixel_history.h"
+#include "../place_core/tiled_timeline.h"
+#include "../place_core/timeline_cursor.h"
+#include "../place_core/latency_histogram.h"
+#include "../place_core/paged_timeline.h"
+#include "../place_core/parallel.h"
+#include "../place_core/stage_trace.h"
+#include "../place_core/step_coalescer.h"
+#include "../place_core/step_pipeline.h"
+
+// writes the chrome trace and prints the stage summary when main returns, if --trace asked for it
+class TraceReport
 {
 public:
-	uint32_t	timestamp;
-	uint32_t	x;
-	uint32_t	y;
-	DiffColor	color;
-};
+	explicit TraceReport(const std::string& trace_path)
+		: m_Path(trace_path)
+		, m_Start(std::chrono::steady_clock::now())
+	{
+		if (!m_Path.empty())
+			stage_trace::Enable();
+	}
 
-class BitMapColor
-{
-public:
-	BitMapColor()
-		: m_red(0xFF)
-		, m_green(0xFF)
-		, m_blue(0xFF)
+	~TraceReport()
 	{
+		if (m_Path.empty())
+			return;
+
+		stage_trace::Disable();
+		const double wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_Start).count();
+		std::cout << std::endl;
+		stage_trace::PrintSummary(std::cout, wall_ms);
+		if (stage_trace::WriteChromeTrace(m_Path))
+			std::cout << "trace written to " << m_Path << std::endl;
+		else
+			std::cout << "Failed to write " << m_Path << std::endl;
 	}
 
-	BitMapColor(DiffColor diff_color)
+private:
+	std::string								m_Path;
+	std::chrono::steady_clock::time_point	m_Start;
+};
+
+void print_progress(double curr, double total, bool step)
+{
+	double progress = (curr / total) * 100.0;
+	switch (step)
 	{
-		uint32_t color = BitMapColor::Convert(diff_color);
-		m_blue = (color & 0x00FF0000) >> 16;
-		m_green = (color & 0x0000FF00) >> 8;
-		m_red = (color & 0x000000FF);
+		case 0:
+			std::cout << "Reading diffs file [" << progress << "%]...\t\r";
+			break;
+		case 1:
+			std::cout << "Generating bitmap " << curr << " of " << total << " [" << progress << "%]...\t\r";
+			break;
 	}
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
-	BitMapColor(uint8_t r, uint8_t g, uint8_t b)
-		: m_red(r)
-		, m_green(g)
-		, m_blue(b)
+void print_load_stats(const char* label, const DiffArchiveStats& stats)
+{
+	const double total_ms = stats.open_ms + stats.scan_ms;
+	const double mb = static_cast<double>(stats.file_bytes) / (1024.0 * 1024.0);
+	std::cout << label << (stats.packed ? " (packed):   " : stats.mapped ? " (mapped):   " : " (buffered): ")
+		<< "open " << stats.open_ms << " ms, scan " << stats.scan_ms << " ms, "
+		<< stats.record_count << " records, " << stats.step_count << " steps, "
+		<< (total_ms > 0.0 ? mb / (total_ms / 1000.0) : 0.0) << " MB/s" << std::endl;
+}
+
+// one line when the archive is clean, otherwise the counts and the first dropped records
+void print_validation_report(const DiffValidationReport& report, double validate_ms)
+{
+	std::cout << "validate: " << report.checked << " records in " << validate_ms << " ms";
+	if (report.Clean())
 	{
+		std::cout << ", all on the canvas with palette colors" << std::endl;
+		return;
 	}
 
-	static uint32_t Convert(DiffColor color)
+	std::cout << ", " << report.out_of_range << " off the canvas dropped, " << report.invalid_colors
+		<< " with colors outside the palette drawn white" << std::endl;
+	for (const auto& diff : report.quarantined)
+		std::cout << "  quarantined: t " << diff.timestamp << " (" << diff.x << ", " << diff.y << ") color "
+			<< static_cast<uint32_t>(diff.color) << std::endl;
+	if (report.out_of_range > report.quarantined.size())
+		std::cout << "  ... and " << report.out_of_range - report.quarantined.size() << " more" << std::endl;
+}
+
+void print_timeline_memory(const DiffTimeline& timeline, const DiffArchive& archive)
+{
+	const double mb = 1024.0 * 1024.0;
+	const uint64_t record_heap = archive.IsMapped() ? 0 : archive.Count() * sizeof(PlaceDiff);
+	std::cout << "timeline: " << timeline.StepCount() << " steps, "
+		<< (timeline.IndexBytes() + record_heap) / mb << " MB heap ("
+		<< timeline.IndexBytes() / mb << " MB step index), nested vector layout: "
+		<< timeline.NestedLayoutBytes() / mb << " MB" << std::endl;
+}
+
+// loads the archive cold and warm with each load mode and prints what it costs
+// then with thread_count readers and scanners, which must find exactly the same steps
+int report_load_cost(const std::string& diffs_path, uint32_t thread_count)
+{
+	const DiffArchive::LoadMode modes[] = { DiffArchive::LoadMode::Mapped, DiffArchive::LoadMode::Buffered };
+	std::vector<uint64_t> serial_starts;
+	std::vector<uint64_t> parallel_starts;
+	for (const auto mode : modes)
 	{
-		switch (color)
+		const uint32_t run_threads[] = { 1, thread_count };
+		for (uint32_t run = 0; run < (thread_count > 1 ? 2u : 1u); ++run)
 		{
-			case White:			return 0xFFFFFF;
-			case Gray10:		return 0xE4E4E4;
-			case Gray50:		return 0x888888;
-			case Gray90:		return 0x222222;
-			case Pink:			return 0xFFA7D1;
-			case Red:			return 0xE50000;
-			case Orange:		return 0xE59500;
-			case DarkOrange:	return 0xA06A42;
-			case Yellow:		return 0xE5D900;
-			case LimeGreen:		return 0x94E044;
-			case Green:			return 0x02BE01;
-			case LightBlue:		return 0x00D3DD;
-			case MediumBlue:	return 0x0083C7;
-			case Blue:			return 0x0000EA;
-			case LightPurle:	return 0xCF6EE4;
-			case Purple:		return 0x820080;
+			const uint32_t threads = run_threads[run];
+			std::vector<uint64_t>& step_starts = (threads == 1) ? serial_starts : parallel_starts;
+			const bool cold = DiffArchive::DropPageCache(diffs_path);
+			for (const char* label : { cold ? "cold" : "cold (page cache not dropped)", "warm" })
+			{
+				DiffArchive archive;
+				if (!archive.Open(diffs_path, mode, threads))
+				{
+					std::cout << "Failed to open diffs file!" << std::endl;
+					return 1;
+				}
+
+				archive.ScanStepStarts(step_starts, threads);
+				std::cout << threads << (threads == 1 ? " thread,  " : " threads, ");
+				print_load_stats(label, archive.Stats());
+			}
+		}
+
+		if (thread_count > 1 && parallel_starts != serial_starts)
+		{
+			std::cout << "The " << thread_count << " thread scan found different steps than the serial one!" << std::endl;
+			return 1;
 		}
-		return 0;
 	}
 
-private:
-	uint8_t m_red;
-	uint8_t m_green;
-	uint8_t m_blue;
-};
+	return 0;
+}
 
-class BitMapInfoHeader
+// writes one bitmap per step in [first_step, last_step), bmp must already hold the canvas after first_step steps.
+// frames are queued on writer when there is one, otherwise written before the next step is applied.
+// level > 0 writes the 1 / 2^level scale image from the bitmap's pyramid instead of the full frame
+template <uint32_t ColorCount>
+void export_steps(const DiffTimeline& timeline, uint64_t first_step, uint64_t last_step, BitMapCoreT<ColorCount>& bmp,
+	const std::string& name, uint32_t level, FrameWriter* writer, std::atomic<uint64_t>& frames_done, bool report_progress)
 {
-public:
-	BitMapInfoHeader() = delete;
-	BitMapInfoHeader(int32_t width, int32_t height, int8_t color_res = 24)
-		: m_Size(sizeof(BitMapInfoHeader))
-		, m_Width(width)				// width height (pixels)
-		, m_Height(height)				// image height (pixels)
-		, m_Planes(1)					// 1 plane
-		, m_ColorBitCount(color_res)	// 4 bit colot, 16 bit color, 24 bit color, etc...
-		, m_Compression(0)				// RGB
-		, m_SizeImage(height * ((width * sizeof(BitMapColor)) + ((4 - (width * sizeof(BitMapColor)) % 4) % 4))) // row count * (4 byte aligned column byte count)
-		, m_XPixelsPerM(0)
-		, m_YPixelsPerM(0)
-		, m_ColorUsed(0)
-		, m_ColorImportant(0)
+	const auto start_time = timeline.Step(0).Timestamp();
+	const double total_steps = static_cast<double>(timeline.StepCount());
+	for (uint64_t step = first_step; step < last_step; ++step)
 	{
+		if (report_progress && step % 100 == 0)
+			print_progress(static_cast<double>(frames_done.load()), total_steps, 1);
+
+		const DiffStep diff_step = timeline.Step(step);
+		auto relative_time = diff_step.Timestamp() - start_time;
+		bmp.SetName(name + std::to_string(relative_time));
+		{
+			stage_trace::TraceScope trace("update", diff_step.size());
+			bmp.Update(diff_step);
+		}
+		if (writer != nullptr)
+			writer->Write(bmp.Name(), bmp.GenerateBMPData(level));
+		else
+		{
+			stage_trace::TraceScope trace("write", bmp.GenerateBMPData(level).size());
+			bmp.Write(std::string(), level);
+		}
+		++frames_done;
 	}
+}
 
-	int32_t Width()	 const { return m_Width; }
-	int32_t Height() const { return m_Height; }
+// splits the timeline into one contiguous range per thread, each thread seeds its own
+// bitmap from the keyframes and applies, encodes and writes the frames of its range
+template <uint32_t ColorCount>
+void export_parallel(const DiffTimeline& timeline, const CanvasFormat& format, const std::string& name, uint32_t level, FrameWriter* writer, uint32_t thread_count)
+{
+	KeyframeStoreT<ColorCount> keyframes;
+	keyframes.Build(timeline, format.width, format.height);
 
-private:
-	uint32_t	m_Size;				// specifies the size of the BITMAPINFOHEADER structure, in bytes.
-	int32_t		m_Width;			// specifies the width of the image, in pixels.
-	int32_t		m_Height;			// specifies the height of the image, in pixels.
-	uint16_t	m_Planes;			// specifies the number of planes of the target device, must be set to zero.
-	uint16_t	m_ColorBitCount;	// specifies the number of bits per pixel - the color resolution. (1 = black/white, 4 = 16 colors, 8 = 256 colors, 24 = 16.7 million colors)
-	uint32_t	m_Compression;		// Specifies the type of compression, usually set to zero (no compression).
-	uint32_t	m_SizeImage;		// specifies the size of the image data, in bytes. If there is no compression, it is valid to set this member to zero.
-	int32_t		m_XPixelsPerM;		// specifies the the horizontal pixels per meter on the designated targer device, usually set to zero.
-	int32_t		m_YPixelsPerM;		// specifies the the vertical pixels per meter on the designated targer device, usually set to zero.
-	uint32_t	m_ColorUsed;		// specifies the number of colors used in the bitmap, if set to zero the number of colors is calculated using the biBitCount member.
-	uint32_t	m_ColorImportant;	// specifies the number of color that are 'important' for the bitmap, if set to zero, all colors are important.
-};
+	std::atomic<uint64_t> frames_done(0);
+	RunParallel(thread_count, [&](uint32_t worker)
+	{
+		uint64_t first_step = 0;
+		uint64_t last_step = 0;
+		SplitRange(timeline.StepCount(), thread_count, worker, first_step, last_step);
+
+		PlaceCanvasT<ColorCount> canvas(format.width, format.height);
+		keyframes.Restore(first_step, timeline, canvas);
+		BitMapCoreT<ColorCount> bmp(format.width, format.height, name);
+		bmp.SetPalette(format.palette);
+		if (level > 0)
+			bmp.EnablePyramid();
+		bmp.SetCanvas(canvas);
+
+		export_steps(timeline, first_step, last_step, bmp, name, level, writer, frames_done, worker == 0);
+	});
+}
 
-class BitMapFileHeader
+// writes one frame per step of the timeline, on one thread or split over thread_count
+template <uint32_t ColorCount>
+void export_frames(const DiffTimeline& timeline, const CanvasFormat& format, const std::string& name, uint32_t level, FrameWriter* writer, uint32_t thread_count)
 {
-public:
-	BitMapFileHeader(int32_t width, int32_t height)
-		: m_Type(19778)
-		, m_FileSize(sizeof(BitMapFileHeader) + sizeof(BitMapInfoHeader) + (height * (width * sizeof(BitMapColor))))
-		, m_Reserved1(0)
-		, m_Reserved2(0)
-		, m_Offset(0)
+	if (thread_count > 1)
 	{
+		export_parallel<ColorCount>(timeline, format, name, level, writer, thread_count);
+		return;
 	}
 
-	uint32_t FileSize() const
+	std::atomic<uint64_t> frames_done(0);
+	BitMapCoreT<ColorCount> bmp(format.width, format.height, name);
+	bmp.SetPalette(format.palette);
+	if (level > 0)
+		bmp.EnablePyramid();
+	export_steps(timeline, 0, timeline.StepCount(), bmp, name, level, writer, frames_done, true);
+}
+
+// writes one frame every interval seconds of archive time instead of one per step. the steps of
+// each interval are coalesced first, so every pixel is applied and encoded once however busy
+// the interval was. intervals without steps repeat the previous frame to keep the rate fixed
+template <uint32_t ColorCount>
+void export_intervals(const DiffTimeline& timeline, const CanvasFormat& format, const std::string& name, uint32_t level, FrameWriter* writer, uint32_t interval)
+{
+	BitMapCoreT<ColorCount> bmp(format.width, format.height, name);
+	bmp.SetPalette(format.palette);
+	if (level > 0)
+		bmp.EnablePyramid();
+
+	StepCoalescer coalescer(format.width, format.height);
+	const uint32_t start_time = timeline.Step(0).Timestamp();
+	const uint32_t last_time = timeline.Step(timeline.StepCount() - 1).Timestamp();
+	const double total_frames = static_cast<double>((last_time - start_time) / interval + 1);
+	uint64_t frames = 0;
+	uint64_t step = 0;
+	for (uint64_t bucket_end = static_cast<uint64_t>(start_time) + interval; step < timeline.StepCount(); bucket_end += interval)
 	{
-		return m_FileSize;
+		if (frames % 100 == 0)
+			print_progress(static_cast<double>(frames), total_frames, 1);
+
+		const uint64_t last_step = (bucket_end > UINT32_MAX) ? timeline.StepCount() : timeline.FindStep(static_cast<uint32_t>(bucket_end));
+		{
+			stage_trace::TraceScope trace("coalesce");
+			const DiffStep coalesced = coalescer.Coalesce(timeline, step, last_step);
+			trace.SetItems(coalesced.size());
+			stage_trace::TraceScope update_trace("update", coalesced.size());
+			bmp.Update(coalesced);
+		}
+		step = last_step;
+
+		bmp.SetName(name + std::to_string(bucket_end - start_time));
+		if (writer != nullptr)
+			writer->Write(bmp.Name(), bmp.GenerateBMPData(level));
+		else
+		{
+			stage_trace::TraceScope trace("write", bmp.GenerateBMPData(level).size());
+			bmp.Write(std::string(), level);
+		}
+		++frames;
 	}
 
-private:
-	uint16_t m_Type;		// must always be set to 'BM' to declare that this is a .bmp-file.
-	uint32_t m_FileSize;	// specifies the total size of the bmp file in bytes.
-	uint16_t m_Reserved1;	// must always be set to zero.
-	uint16_t m_Reserved2;	// must always be set to zero.
-	uint32_t m_Offset;		// specifies the offset from the beginning of the file to the bitmap data.
-};
+	std::cout << std::endl << "intervals: " << frames << " frames of " << interval << " s from " << timeline.StepCount() << " steps, "
+		<< coalescer.InputRecords() << " records coalesced to " << coalescer.OutputRecords() << " pixel writes" << std::endl;
+}
 
-class BitMap
+// writes one frame per step as the pipeline publishes them, the first frame goes out while the
+// rest of the archive is still being read
+template <uint32_t ColorCount>
+void export_streamed(StepPipeline& pipeline, const CanvasFormat& format, const std::string& name, uint32_t level, FrameWriter* writer,
+	std::chrono::steady_clock::time_point start)
 {
-public:
-	BitMap(const std::string& name, int32_t width, int32_t height)
-		: m_FileHeader(width, height)
-		, m_InfoHeader(width, height, 24)
-		, m_Name(name)
+	BitMapCoreT<ColorCount> bmp(format.width, format.height, name);
+	bmp.SetPalette(format.palette);
+	if (level > 0)
+		bmp.EnablePyramid();
+
+	double first_frame_ms = 0.0;
+	uint32_t start_time = 0;
+	uint64_t step = 0;
+	for (uint64_t published = pipeline.WaitForSteps(0); published > step; published = pipeline.WaitForSteps(step))
 	{
-		m_PixelData.resize(height);
-		for (auto& vec : m_PixelData)
-			vec.resize(width);
+		for (; step < published; ++step)
+		{
+			const DiffStep diff_step = pipeline.Step(step);
+			if (step == 0)
+				start_time = diff_step.Timestamp();
+			if (step % 100 == 0)
+				std::cout << "Generating bitmap " << step << " of " << published << " read so far...\t\r";
 
-		m_Colors = {
-			BitMapColor::Convert(White),
-			BitMapColor::Convert(Gray10),
-			BitMapColor::Convert(Gray50),
-			BitMapColor::Convert(Gray90),
-			BitMapColor::Convert(Pink),
-			BitMapColor::Convert(Red),
-			BitMapColor::Convert(Orange),
-			BitMapColor::Convert(DarkOrange),
-			BitMapColor::Convert(Yellow),
-			BitMapColor::Convert(LimeGreen),
-			BitMapColor::Convert(Green),
-			BitMapColor::Convert(LightBlue),
-			BitMapColor::Convert(MediumBlue),
-			BitMapColor::Convert(Blue),
-			BitMapColor::Convert(LightPurle),
-			BitMapColor::Convert(Purple)
-		};
+			bmp.SetName(name + std::to_string(diff_step.Timestamp() - start_time));
+			{
+				stage_trace::TraceScope trace("update", diff_step.size());
+				bmp.Update(diff_step);
+			}
+			if (writer != nullptr)
+				writer->Write(bmp.Name(), bmp.GenerateBMPData(level));
+			else
+			{
+				stage_trace::TraceScope trace("write", bmp.GenerateBMPData(level).size());
+				bmp.Write(std::string(), level);
+			}
+			if (step == 0)
+				first_frame_ms = elapsed_ms(start);
+		}
 	}
 
-	~BitMap()
+	std::cout << std::endl << "streamed: first step after " << pipeline.Stats().first_step_ms << " ms, first frame after "
+		<< first_frame_ms << " ms, archive read in " << pipeline.Stats().load_ms << " ms over " << pipeline.Stats().blocks
+		<< " blocks" << std::endl;
+}
+
+// seeks to random steps from the keyframes and from step 0 and prints both latency histograms
+template <uint32_t ColorCount>
+int report_seek_latency(const DiffTimeline& timeline, const CanvasFormat& format)
+{
+	const auto build_start = std::chrono::steady_clock::now();
+	KeyframeStoreT<ColorCount> keyframes;
+	keyframes.Build(timeline, format.width, format.height);
+	std::cout << "keyframes: " << keyframes.Count() << " snapshots every " << keyframes.StepInterval() << " steps or "
+		<< keyframes.PixelInterval() << " pixels, " << keyframes.MemoryBytes() / (1024.0 * 1024.0) << " MB, built in "
+		<< elapsed_ms(build_start) << " ms" << std::endl;
+
+	std::mt19937_64 rng(1);
+	std::uniform_int_distribution<uint64_t> pick_step(0, timeline.StepCount());
+	PlaceCanvasT<ColorCount> canvas(format.width, format.height);
+
+	LatencyHistogram keyframe_seeks;
+	for (int i = 0; i < 1000; ++i)
 	{
+		const uint64_t target = pick_step(rng);
+		const auto start = std::chrono::steady_clock::now();
+		keyframes.Restore(target, timeline, canvas);
+		keyframe_seeks.Record(elapsed_ms(start));
 	}
 
-	void SetName(const std::string& name)
+	LatencyHistogram replay_seeks;
+	for (int i = 0; i < 20; ++i)
 	{
-		m_Name = name + ".bmp";
+		const uint64_t target = pick_step(rng);
+		const auto start = std::chrono::steady_clock::now();
+		canvas.Clear();
+		for (uint64_t step = 0; step < target; ++step)
+			canvas.Apply(timeline.Step(step));
+		replay_seeks.Record(elapsed_ms(start));
 	}
 
-	bool Update(const std::vector<PlaceDiff>& timestep)
+	// short scrubs a few steps either way through the cursor, which undoes steps going backwards
+	UndoStreamT<ColorCount> undo;
+	undo.Build(timeline, format.width, format.height);
+	BitMapCoreT<ColorCount> bitmap(format.width, format.height);
+	TimelineCursorT<ColorCount> cursor(timeline, keyframes, undo, bitmap);
+	cursor.SeekTo(timeline.StepCount() / 2);
+
+	LatencyHistogram forward_scrubs;
+	LatencyHistogram backward_scrubs;
+	std::uniform_int_distribution<int> pick_offset(-10, 10);
+	for (int i = 0; i < 1000; ++i)
 	{
-		for (const auto& pixel : timestep)
-		{
-			BitMapColor color(pixel.color);
-			uint32_t row = pixel.y;
-			uint32_t col = pixel.x;
-
-			if (row >= m_PixelData.size())
-				return false;
+		const int offset = pick_offset(rng);
+		const uint64_t target = (offset < 0 && cursor.AppliedSteps() < static_cast<uint64_t>(-offset)) ? 0 : cursor.AppliedSteps() + offset;
+		const auto start = std::chrono::steady_clock::now();
+		cursor.SeekTo(target);
+		(offset < 0 ? backward_scrubs : forward_scrubs).Record(elapsed_ms(start));
+	}
 
-			std::vector<BitMapColor>& bmp_row = m_PixelData[row];
-			if (col >= bmp_row.size())
-				return false;
+	keyframe_seeks.Print(std::cout, "seek from keyframe");
+	replay_seeks.Print(std::cout, "seek by replay from step 0");
+	forward_scrubs.Print(std::cout, "scrub forward 0-10 steps");
+	backward_scrubs.Print(std::cout, "scrub backward 1-10 steps");
+	return 0;
+}
 
-			bmp_row[col] = color;
+// checks every row expansion kernel against the bitmap built step by step and times each one
+template <uint32_t ColorCount>
+int report_kernels(const DiffTimeline& timeline, const CanvasFormat& format)
+{
+	// the incrementally patched encoding of the final frame is the reference
+	BitMapCoreT<ColorCount> reference(format.width, format.height);
+	reference.SetPalette(format.palette);
+	for (uint64_t step = 0; step < timeline.StepCount(); ++step)
+		reference.Update(timeline.Step(step));
+
+	const PlaceCanvasT<ColorCount>& canvas = reference.Canvas();
+	BitMapCoreT<ColorCount> bmp(format.width, format.height);
+	bmp.SetPalette(format.palette);
+	bool all_match = true;
+	for (const BmpKernel kernel : { BmpKernel::Scalar, BmpKernel::Ssse3, BmpKernel::Avx2 })
+	{
+		if (!bmp_expand::Supported(kernel))
+		{
+			std::cout << bmp_expand::Name(kernel) << ": not supported by this cpu" << std::endl;
+			continue;
 		}
 
-		return true;
+		bmp.SetKernel(kernel);
+		bmp.SetCanvas(canvas);
+		const bool match = bmp.GenerateBMPData() == reference.GenerateBMPData();
+		all_match = all_match && match;
+
+		static const int frame_count = 100;
+		const auto frame_start = std::chrono::steady_clock::now();
+		for (int i = 0; i < frame_count; ++i)
+			bmp.SetCanvas(canvas);
+		const double frame_ms = elapsed_ms(frame_start) / frame_count;
+
+		// rows stay in cache, the palette does not matter for timing
+		static const int row_count = 100000;
+		const BmpExpandTablesT<ColorCount> tables = BmpExpandTablesT<ColorCount>();
+		std::vector<char> row(static_cast<size_t>(canvas.Width()) * 3);
+		const auto row_start = std::chrono::steady_clock::now();
+		for (int i = 0; i < row_count; ++i)
+			bmp_expand::ExpandRow(kernel, canvas.Row(i % canvas.Height()), canvas.Width(), tables, row.data());
+		const double row_ns = elapsed_ms(row_start) * 1000000.0 / row_count;
+
+		std::cout << bmp_expand::Name(kernel) << (kernel == bmp_expand::Best() ? " (selected)" : "") << ": "
+			<< (match ? "matches" : "DOES NOT MATCH") << ", " << frame_ms << " ms per frame, " << row_ns << " ns per row, "
+			<< (canvas.Width() * 3.0) / row_ns << " GB/s" << std::endl;
 	}
 
-	std::vector<char> GenerateBMP() const
-	{
-		std::vector<char> bmp_data;
-		bmp_data.resize(m_FileHeader.FileSize());
-
-		size_t bytes_written = 0;
-
-		// write bmp file header
-		const auto& file_header_begin = reinterpret_cast<const char*>(&m_FileHeader);
-		const auto& file_header_end = file_header_begin + sizeof(m_FileHeader);
-		std::copy(file_header_begin, file_header_end, bmp_data.begin() + bytes_written);
-		bytes_written += sizeof(m_FileHeader);
-
-		// write bmp info header
-		const auto& info_header_begin = reinterpret_cast<const char*>(&m_InfoHeader);
-		const auto& info_header_end = info_header_begin + sizeof(m_InfoHeader);
-		std::copy(info_header_begin, info_header_end, bmp_data.begin() + bytes_written);
-		bytes_written += sizeof(m_InfoHeader);
+	return all_match ? 0 : 1;
+}
 
-		// write image data
-		const auto height = m_InfoHeader.Height();
-		const auto width = m_InfoHeader.Width();
-		for (int32_t row = height; row--; /*empty*/)
-		{
-			for (int32_t col = 0; col < width; ++col)
+// aggregates [t0, t1] (seconds after the first step) and writes the change heatmap and the dominant colors
+int write_heatmap(const DiffTimeline& timeline, const CanvasFormat& format, uint32_t t0, uint32_t t1, uint32_t thread_count)
+{
+	const uint32_t start_time = timeline.Step(0).Timestamp();
+	const auto start = std::chrono::steady_clock::now();
+	ActivityMap activity;
+	activity.Build(timeline, format.width, format.height, start_time + t0, start_time + t1, thread_count);
+	const double build_ms = elapsed_ms(start);
+
+	uint32_t hot_x = 0;
+	uint32_t hot_y = 0;
+	for (int32_t y = 0; y < format.height; ++y)
+		for (int32_t x = 0; x < format.width; ++x)
+			if (activity.ChangeCount(x, y) > activity.ChangeCount(hot_x, hot_y))
 			{
-				const BitMapColor& rgb = m_PixelData[row][col];
-				const auto& rgb_begin = reinterpret_cast<const char*>(&rgb);
-				const auto& rgb_end = rgb_begin + sizeof(rgb);
-				std::copy(rgb_begin, rgb_end, bmp_data.begin() + bytes_written);
-				bytes_written += sizeof(rgb);
+				hot_x = x;
+				hot_y = y;
 			}
 
-			// pad each row to ensure 4 byte alignment
-			static const char padding[4] = { 0, 0, 0, 0 };
-			const auto row_bytes = sizeof(BitMapColor) * width;
-			const auto pad_bytes = (4 - (row_bytes % 4)) % 4;
-			const auto& padding_begin = reinterpret_cast<const char*>(&padding);
-			const auto& padding_end = padding_begin + pad_bytes;
-			std::copy(padding_begin, padding_end, bmp_data.begin() + bytes_written);
-			bytes_written += pad_bytes;
-		}
+	std::cout << "heatmap " << t0 << "-" << t1 << ": " << activity.RecordCount() << " records in " << build_ms << " ms ("
+		<< (build_ms > 0.0 ? activity.RecordCount() / build_ms / 1000.0 : 0.0) << " M records/s), busiest pixel ("
+		<< hot_x << ", " << hot_y << ") changed " << activity.MaxChangeCount() << " times, last at "
+		<< (activity.MaxChangeCount() > 0 ? activity.LastChange(hot_x, hot_y) - start_time : 0) << std::endl;
+
+	const std::string suffix = std::to_string(t0) + "_" + std::to_string(t1);
+	PlaceCanvas canvas(format.width, format.height);
+	BitMapCore bmp(format.width, format.height);
+	bmp.SetPalette(format.palette);
+
+	activity.RenderDominant(canvas);
+	bmp.SetCanvas(canvas);
+	bmp.SetName("dominant_" + suffix);
+	bmp.Write();
+
+	BitMapColor heat_palette[PlaceCanvas::palette_size];
+	ActivityMap::HeatPalette(heat_palette);
+	activity.RenderHeat(canvas);
+	bmp.SetCanvas(canvas);
+	bmp.SetPalette(heat_palette);
+	bmp.SetName("heatmap_" + suffix);
+	bmp.Write();
+	return 0;
+}
 
-		assert(bytes_written == m_FileHeader.FileSize());
+// loads the pixel history saved next to the archive, or builds and saves it, then checks it
+// against full replays and prints the latency of single pixel queries
+int report_pixel_history(const DiffTimeline& timeline, const CanvasFormat& format, const std::string& diffs_path, uint32_t thread_count)
+{
+	const std::string index_path = diffs_path + ".pxi";
+	PixelHistory history;
+	auto start = std::chrono::steady_clock::now();
+	if (history.Load(index_path, timeline, format.width, format.height))
+	{
+		std::cout << "pixel history: loaded " << index_path << " in " << elapsed_ms(start) << " ms" << std::endl;
+	}
+	else
+	{
+		history.Build(timeline, format.width, format.height, thread_count);
+		std::cout << "pixel history: built with " << thread_count << " threads in " << elapsed_ms(start) << " ms";
+		if (history.Save(index_path))
+			std::cout << ", saved to " << index_path << std::endl;
+		else
+			std::cout << ", could not save " << index_path << std::endl;
+	}
+	std::cout << "pixel history: " << history.EntryCount() << " entries, " << history.MemoryBytes() / (1024.0 * 1024.0) << " MB" << std::endl;
+
+	// every pixel at a few steps must match a replay of the steps up to it
+	std::mt19937 random(7);
+	std::vector<uint64_t> check_steps;
+	for (int i = 0; i < 4; ++i)
+		check_steps.push_back(random() % timeline.StepCount());
+	check_steps.push_back(timeline.StepCount() - 1);
+	std::sort(check_steps.begin(), check_steps.end());
+
+	PlaceCanvas canvas(format.width, format.height);
+	uint64_t applied = 0;
+	uint64_t mismatches = 0;
+	for (const uint64_t step : check_steps)
+	{
+		while (applied <= step)
+			canvas.Apply(timeline.Step(applied++));
+
+		const uint32_t t = timeline.Step(step).Timestamp();
+		for (int32_t y = 0; y < format.height; ++y)
+			for (int32_t x = 0; x < format.width; ++x)
+				if (history.ColorAt(x, y, t) != canvas.Get(x, y))
+					++mismatches;
+	}
+	std::cout << "pixel history: " << check_steps.size() << " full frames checked against replay, "
+		<< mismatches << " mismatched pixels" << std::endl;
+
+	const uint32_t first_time = timeline.Step(0).Timestamp();
+	const uint32_t last_time = timeline.Step(timeline.StepCount() - 1).Timestamp();
+	LatencyHistogram query_latency;
+	uint32_t checksum = 0;
+	for (int i = 0; i < 100000; ++i)
+	{
+		const uint32_t x = random() % format.width;
+		const uint32_t y = random() % format.height;
+		const uint32_t t = first_time + random() % (last_time - first_time + 1);
 
-		return bmp_data;
+		start = std::chrono::steady_clock::now();
+		checksum += history.ColorAt(x, y, t);
+		query_latency.Record(elapsed_ms(start));
 	}
+	query_latency.Print(std::cout, "color of (x, y) at t");
+
+	// the per query samples include reading the clock, time a batch for the real cost
+	static const int batch_size = 1000000;
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < batch_size; ++i)
+		checksum += history.ColorAt(random() % format.width, random() % format.height, first_time + random() % (last_time - first_time + 1));
+	std::cout << "batched: " << elapsed_ms(start) * 1000000.0 / batch_size << " ns per query (checksum " << checksum << ")" << std::endl;
 
-	bool Write() const
+	return mismatches == 0 ? 0 : 1;
+}
+
+// renders a w x h region at t seconds from the tiles, checks it against a full replay and
+// times region renders of growing size to show the cost follows the region, not the canvas
+int write_region(const DiffTimeline& timeline, const CanvasFormat& format, int32_t x0, int32_t y0, int32_t width, int32_t height, uint32_t t, uint32_t thread_count)
+{
+	auto start = std::chrono::steady_clock::now();
+	TiledTimeline tiles;
+	tiles.Build(timeline, format.width, format.height, TiledTimeline::default_keyframe_interval, thread_count);
+	std::cout << "tiles: " << tiles.TileCount() << " tiles of " << TiledTimeline::tile_size << "x" << TiledTimeline::tile_size
+		<< " built in " << elapsed_ms(start) << " ms, " << tiles.MemoryBytes() / (1024.0 * 1024.0) << " MB" << std::endl;
+
+	const uint32_t time = timeline.Step(0).Timestamp() + t;
+	PlaceCanvas region(width, height);
+	start = std::chrono::steady_clock::now();
+	const uint32_t tiles_read = tiles.RenderRegion(x0, y0, time, region);
+	std::cout << "region " << width << "x" << height << " at (" << x0 << ", " << y0 << "): " << tiles_read << " tiles in "
+		<< elapsed_ms(start) << " ms" << std::endl;
+
+	// the same region cut out of a full replay
+	PlaceCanvas canvas(format.width, format.height);
+	for (uint64_t step = 0; step < timeline.FindStep(time + 1); ++step)
+		canvas.Apply(timeline.Step(step));
+	uint64_t mismatches = 0;
+	for (int32_t y = 0; y < height && y0 + y < format.height; ++y)
+		for (int32_t x = 0; x < width && x0 + x < format.width; ++x)
+			if (region.Get(x, y) != canvas.Get(x0 + x, y0 + y))
+				++mismatches;
+	std::cout << "region: " << mismatches << " pixels differ from the full replay" << std::endl;
+
+	BitMapCore bmp(width, height);
+	bmp.SetPalette(format.palette);
+	bmp.SetCanvas(region);
+	bmp.SetName("region_" + std::to_string(x0) + "_" + std::to_string(y0) + "_" + std::to_string(width) + "_"
+		+ std::to_string(height) + "_" + std::to_string(t));
+	bmp.Write();
+
+	std::mt19937 random(11);
+	const uint32_t first_time = timeline.Step(0).Timestamp();
+	const uint32_t time_span = timeline.Step(timeline.StepCount() - 1).Timestamp() - first_time + 1;
+	for (const int32_t size : { 64, 128, 256, 512, 1000, 2000 })
 	{
-		std::ofstream bmp2(m_Name, std::ios::out | std::ios::binary);
-		if (bmp2.is_open())
+		if (size > format.width || size > format.height)
+			break;
+
+		LatencyHistogram latency;
+		PlaceCanvas view(size, size);
+		for (int i = 0; i < 200; ++i)
 		{
-			std::vector<char> data = GenerateBMP();
-			bmp2.write(data.data(), data.size());
-			bmp2.close();
+			const int32_t view_x = static_cast<int32_t>(random() % (format.width - size + 1));
+			const int32_t view_y = static_cast<int32_t>(random() % (format.height - size + 1));
+			const uint32_t view_time = first_time + random() % time_span;
+			start = std::chrono::steady_clock::now();
+			tiles.RenderRegion(view_x, view_y, view_time, view);
+			latency.Record(elapsed_ms(start));
 		}
+		std::cout << "random " << size << "x" << size << " regions: p50 " << latency.Percentile(50.0) << " ms, p99 "
+			<< latency.Percentile(99.0) << " ms" << std::endl;
+	}
 
-		return true;
+	return mismatches == 0 ? 0 : 1;
+}
+
+// re-encodes the archive in the packed format, sized to the largest coordinate and color it holds
+int pack_archive(const DiffArchive& archive, const CanvasFormat& format, const std::string& packed_path)
+{
+	uint32_t max_coord = 0;
+	uint32_t max_color = 0;
+	for (const auto& diff : archive)
+	{
+		max_coord = (std::max)(max_coord, (std::max)(diff.x, diff.y));
+		max_color = (std::max)(max_color, static_cast<uint32_t>(diff.color));
 	}
 
-	bool WriteBMP() const
+	const auto start = std::chrono::steady_clock::now();
+	PackedArchiveWriter writer;
+	if (!writer.Open(packed_path, format.width, format.height, packed_archive::BitsFor(max_coord), packed_archive::BitsFor(max_color)))
 	{
+		std::cout << "Failed to create " << packed_path << std::endl;
+		return 1;
+	}
 
-		std::ofstream bmp(m_Name, std::ios::out | std::ios::binary);
-		if (bmp.is_open())
-		{
-			// write bmp file header
-			bmp.write(reinterpret_cast<const char*>(&m_FileHeader), sizeof(m_FileHeader));
+	for (const auto& diff : archive)
+		writer.Append(diff);
 
-			// write bmp info header
-			bmp.write(reinterpret_cast<const char*>(&m_InfoHeader), sizeof(m_InfoHeader));
+	if (!writer.Close())
+	{
+		std::cout << "Failed to write " << packed_path << std::endl;
+		return 1;
+	}
 
-			// write pixel data
-			const auto height = m_InfoHeader.Height();
-			const auto width = m_InfoHeader.Width();
-			for (int32_t row = height; row--; /*empty*/)
-			{
-				for (int32_t col = 0; col < width; ++col)
-				{
-					const BitMapColor& rgb = m_PixelData[row][col];
-					bmp.write(reinterpret_cast<const char*>(&rgb), sizeof(rgb));
-				}
+	const uint64_t packed_bytes = writer.BytesWritten();
+	const uint64_t raw_bytes = archive.Count() * sizeof(PlaceDiff);
+	std::cout << "packed " << archive.Count() << " records: " << raw_bytes << " -> " << packed_bytes << " bytes ("
+		<< (packed_bytes > 0 ? static_cast<double>(raw_bytes) / static_cast<double>(packed_bytes) : 0.0) << "x) in "
+		<< elapsed_ms(start) << " ms" << std::endl;
+
+	// decode it again and make sure nothing was lost
+	DiffArchive packed;
+	if (!packed.Open(packed_path) || packed.Count() != archive.Count()
+		|| !std::equal(archive.begin(), archive.end(), packed.begin(), [](const PlaceDiff& a, const PlaceDiff& b)
+			{ return a.timestamp == b.timestamp && a.x == b.x && a.y == b.y && a.color == b.color; }))
+	{
+		std::cout << "Packed archive does not match the original" << std::endl;
+		return 1;
+	}
 
-				static char padding[4] = { 0,0,0,0 };
-				auto row_bytes = sizeof(BitMapColor) * width;
-				auto pad_bytes = (4 - (row_bytes % 4)) % 4;
-				bmp.write(padding, pad_bytes);
-			}
-			bmp.close();
-		}
+	print_load_stats("decode", packed.Stats());
 
-		return true;
+	// the header keeps the canvas size, a palette other than 2017's needs its sidecar
+	if (!format.IsDefault() && !format.Save(CanvasFormat::SidecarPath(packed_path)))
+	{
+		std::cout << "Failed to write " << CanvasFormat::SidecarPath(packed_path) << std::endl;
+		return 1;
 	}
+	return 0;
+}
 
-private:
-	BitMapFileHeader						m_FileHeader;
-	BitMapInfoHeader						m_InfoHeader;
-	std::vector<uint32_t>					m_Colors;
-	std::vector<std::vector<BitMapColor>>	m_PixelData;
-	std::vector<uint8_t>					m_BitmapBits;
-	std::string								m_Name;
-};
+// reads the archive on a loader thread while the frames of the steps read so far are rendered and written
+int stream_export(const std::string& diffs_path, uint32_t level, uint32_t writer_count, uint32_t buffer_count)
+{
+	CanvasFormat format;
+	if (!format.Load(diffs_path) || format.ColorCount() > CanvasFormat::max_colors)
+	{
+		std::cout << "Failed to read " << CanvasFormat::SidecarPath(diffs_path) << std::endl;
+		return 1;
+	}
+	std::cout << "canvas: " << format.width << "x" << format.height << ", " << format.ColorCount() << " colors" << std::endl;
 
-void print_progress(double curr, double total, bool step)
+	const auto export_start = std::chrono::steady_clock::now();
+	StepPipeline pipeline;
+	if (!pipeline.Start(diffs_path, format.width, format.height, format.ColorCount()))
+	{
+		std::cout << "Failed to open diffs file!" << std::endl;
+		return 1;
+	}
+
+	std::unique_ptr<FrameWriter> writer;
+	if (writer_count > 0)
+		writer.reset(new FrameWriter(writer_count, buffer_count > 0 ? buffer_count : 2 + writer_count));
+
+	const std::string name = "place";
+	WithPaletteSize(format.ColorCount(), [&](auto palette_size)
+	{
+		export_streamed<decltype(palette_size)::value>(pipeline, format, name, level, writer.get(), export_start);
+	});
+
+	const bool loaded = pipeline.Finish();
+	if (!loaded)
+		std::cout << "The diffs file could not be read to the end!" << std::endl;
+	print_validation_report(pipeline.Archive().Report(), pipeline.Archive().Stats().validate_ms);
+
+	if (writer)
+	{
+		const bool written = writer->Close();
+		const FrameWriterStats& stats = writer->Stats();
+		std::cout << "writers: " << stats.frames << " frames, " << stats.bytes / (1024.0 * 1024.0) << " MB, "
+			<< writer_count << " threads busy " << stats.write_ms << " ms, render stalled " << stats.stall_ms << " ms" << std::endl;
+		if (!written)
+			std::cout << stats.failed << " frames could not be written!" << std::endl;
+	}
+	std::cout << "export: " << pipeline.Timeline().StepCount() << " frames in " << elapsed_ms(export_start) << " ms" << std::endl;
+	return loaded ? 0 : 1;
+}
+
+// writes one frame per step straight off the disk, with only the paged timeline's index and block cache resident
+template <uint32_t ColorCount>
+bool export_paged(PagedTimelineT<ColorCount>& paged, const CanvasFormat& format, const std::string& name, uint32_t level, FrameWriter* writer)
 {
-	double progress = (curr / total) * 100.0;
-	switch (step)
+	BitMapCoreT<ColorCount> bmp(format.width, format.height, name);
+	bmp.SetPalette(format.palette);
+	if (level > 0)
+		bmp.EnablePyramid();
+
+	uint32_t start_time = 0;
+	const double total_steps = static_cast<double>(paged.StepCount());
+	for (uint64_t step = 0; step < paged.StepCount(); ++step)
 	{
-		case 0:
-			std::cout << "Reading diffs file [" << progress << "%]...\t\r";
-			break;
-		case 1:
-			std::cout << "Generating bitmap " << curr << " of " << total << " [" << progress << "%]...\t\r";
-			break;
+		if (step % 100 == 0)
+			print_progress(static_cast<double>(step), total_steps, 1);
+
+		const DiffStep diff_step = paged.Step(step);
+		if (paged.Failed())
+			return false;
+		if (step == 0)
+			start_time = diff_step.Timestamp();
+
+		bmp.SetName(name + std::to_string(diff_step.Timestamp() - start_time));
+		{
+			stage_trace::TraceScope trace("update", diff_step.size());
+			bmp.Update(diff_step);
+		}
+		if (writer != nullptr)
+			writer->Write(bmp.Name(), bmp.GenerateBMPData(level));
+		else
+		{
+			stage_trace::TraceScope trace("write", bmp.GenerateBMPData(level).size());
+			bmp.Write(std::string(), level);
+		}
 	}
+	std::cout << std::endl;
+	return true;
 }
 
-int main()
+// exports an archive larger than memory: the steps stay on disk behind a block cache sized from memory_budget
+int paged_export(const std::string& diffs_path, uint64_t memory_budget, uint32_t level, uint32_t writer_count, uint32_t buffer_count)
 {
-	std::ifstream diffs_file("diffs.bin", std::ios::in | std::ios::binary);
+	CanvasFormat format;
+	if (!format.Load(diffs_path) || format.ColorCount() > CanvasFormat::max_colors)
+	{
+		std::cout << "Failed to read " << CanvasFormat::SidecarPath(diffs_path) << std::endl;
+		return 1;
+	}
+	std::cout << "canvas: " << format.width << "x" << format.height << ", " << format.ColorCount() << " colors" << std::endl;
 
-	std::vector<std::vector<PlaceDiff>> diffs;
-	if (diffs_file.is_open())
+	std::unique_ptr<FrameWriter> writer;
+	if (writer_count > 0)
+		writer.reset(new FrameWriter(writer_count, buffer_count > 0 ? buffer_count : 2 + writer_count));
+
+	PagedTimelinePolicy policy;
+	policy.memory_budget = memory_budget;
+	const double mb = 1024.0 * 1024.0;
+	int result = 0;
+	WithPaletteSize(format.ColorCount(), [&](auto palette_size)
 	{
-		PlaceDiff diff;
-		uint32_t timestamp = 0;
+		PagedTimelineT<decltype(palette_size)::value> paged;
+		if (!paged.Open(diffs_path, format.width, format.height, format.ColorCount(), policy))
+		{
+			std::cout << "Failed to open diffs file! Out of core export reads raw archives only." << std::endl;
+			result = 1;
+			return;
+		}
 
-		auto file_start = diffs_file.tellg();
-		diffs_file.seekg(0, std::ios::end);
-		auto file_end = diffs_file.tellg();
-		diffs_file.seekg(0, std::ios::beg);
-		double file_length = static_cast<double>(file_end - file_start);
+		const PagedTimelineStats& stats = paged.Stats();
+		std::cout << "paged: " << paged.RecordCount() << " records, " << paged.StepCount() << " steps scanned in " << stats.scan_ms
+			<< " ms, " << stats.index_bytes / mb << " MB index, " << stats.cache_blocks << " cached blocks in a "
+			<< memory_budget / mb << " MB budget" << std::endl;
+		print_validation_report(paged.Report(), stats.scan_ms);
 
-		uint32_t count = 0;
-		while (!diffs_file.eof())
+		const auto export_start = std::chrono::steady_clock::now();
+		if (!export_paged(paged, format, "place", level, writer.get()))
 		{
-			if (++count % 100000 == 0)
-				print_progress(static_cast<double>(diffs_file.tellg() - file_start), file_length, 0);
+			std::cout << "The diffs file could not be read!" << std::endl;
+			result = 1;
+		}
+		const double export_ms = elapsed_ms(export_start);
+		std::cout << "paged: " << stats.block_reads << " blocks read, " << stats.bytes_read / mb << " MB, "
+			<< (export_ms > 0.0 ? paged.RecordCount() / (export_ms / 1000.0) : 0.0) << " records/s, "
+			<< paged.MemoryBytes() / mb << " MB resident" << std::endl;
+		std::cout << "export: " << paged.StepCount() << " frames in " << export_ms << " ms" << std::endl;
+	});
+
+	if (writer)
+	{
+		const bool written = writer->Close();
+		const FrameWriterStats& stats = writer->Stats();
+		std::cout << "writers: " << stats.frames << " frames, " << stats.bytes / mb << " MB, "
+			<< writer_count << " threads busy " << stats.write_ms << " ms, render stalled " << stats.stall_ms << " ms" << std::endl;
+		if (!written)
+			std::cout << stats.failed << " frames could not be written!" << std::endl;
+	}
 
-			diffs_file.read(reinterpret_cast<char*>(&diff), sizeof(diff));
-			if (diff.timestamp != timestamp)
-			{
-				diffs.resize(diffs.size() + 1);
-				timestamp = diff.timestamp;
-			}
-			diffs.back().push_back(diff);
+	const uint64_t peak_rss = stage_trace::PeakRssBytes();
+	if (peak_rss > 0)
+		std::cout << "peak rss: " << peak_rss / mb << " MB" << std::endl;
+	return result;
+}
+
+int main(int argc, char* argv[])
+{
+	std::string diffs_path = "diffs.bin";
+	bool load_report = false;
+	bool seek_report = false;
+	bool kernel_report = false;
+	bool heatmap = false;
+	bool pixel_index = false;
+	bool region = false;
+	int32_t region_rect[4] = {};
+	uint32_t region_time = 0;
+	uint32_t heatmap_t0 = 0;
+	uint32_t heatmap_t1 = 0;
+	std::string packed_path;
+	uint32_t thread_count = 1;
+	uint32_t writer_count = 2;
+	uint32_t level = 0;
+	uint32_t buffer_count = 0;
+	uint32_t interval = 0;
+	uint64_t memory_budget = 0;
+	std::string trace_path;
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		if (arg == "--load-report")
+			load_report = true;
+		else if (arg == "--seek-report")
+			seek_report = true;
+		else if (arg == "--kernel-report")
+			kernel_report = true;
+		else if (arg == "--region" && i + 5 < argc)
+		{
+			region = true;
+			for (int32_t& value : region_rect)
+				value = std::stoi(argv[++i]);
+			region_time = static_cast<uint32_t>(std::stoul(argv[++i]));
 		}
+		else if (arg == "--pixel-index")
+			pixel_index = true;
+		else if (arg == "--heatmap" && i + 2 < argc)
+		{
+			heatmap = true;
+			heatmap_t0 = static_cast<uint32_t>(std::stoul(argv[++i]));
+			heatmap_t1 = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (arg == "--pack" && i + 1 < argc)
+			packed_path = argv[++i];
+		else if (arg == "--threads" && i + 1 < argc)
+			thread_count = static_cast<uint32_t>(std::stoul(argv[++i]));
+		else if (arg == "--scale" && i + 1 < argc)
+		{
+			// 1, 2, 4 or 8 -> pyramid level 0 to 3
+			const uint32_t scale = static_cast<uint32_t>(std::stoul(argv[++i]));
+			level = 0;
+			while (level + 1 < MipPyramid::level_count && (2u << level) <= scale)
+				++level;
+		}
+		else if (arg == "--writers" && i + 1 < argc)
+			writer_count = static_cast<uint32_t>(std::stoul(argv[++i]));
+		else if (arg == "--write-buffers" && i + 1 < argc)
+			buffer_count = static_cast<uint32_t>(std::stoul(argv[++i]));
+		else if (arg == "--interval" && i + 1 < argc)
+			interval = static_cast<uint32_t>(std::stoul(argv[++i]));
+		else if (arg == "--memory-budget" && i + 1 < argc)
+			memory_budget = std::stoull(argv[++i]) * 1024 * 1024;
+		else if (arg == "--trace" && i + 1 < argc)
+			trace_path = argv[++i];
+		else
+			diffs_path = arg;
+	}
+
+	if (thread_count == 0)
+		thread_count = DefaultThreadCount();
+
+	const TraceReport trace_report(trace_path);
 
+	if (load_report)
+		return report_load_cost(diffs_path, thread_count);
+
+	if (memory_budget > 0)
+		return paged_export(diffs_path, memory_budget, level, writer_count, buffer_count);
+
+	// a plain single threaded export renders steps as they are read, everything else needs the whole timeline
+	const bool streamed = thread_count == 1 && interval == 0 && packed_path.empty() && !seek_report && !kernel_report && !heatmap && !pixel_index && !region;
+	if (streamed)
+		return stream_export(diffs_path, level, writer_count, buffer_count);
+
+	// the canvas the records are validated against, before anything uses them
+	CanvasFormat format;
+	if (!format.Load(diffs_path) || format.ColorCount() > CanvasFormat::max_colors)
+	{
+		std::cout << "Failed to read " << CanvasFormat::SidecarPath(diffs_path) << std::endl;
+		return 1;
+	}
+
+	DiffArchive archive;
+	DiffTimeline timeline;
+	if (archive.Open(diffs_path, DiffArchive::LoadMode::Mapped, thread_count))
+		archive.Validate(format.width, format.height, format.ColorCount(), thread_count);
+	if (archive.IsValidated() && timeline.Build(archive, thread_count))
+	{
 		print_progress(100.0, 100.0, 0);
 		std::cout << std::endl;
-		diffs_file.close();
+		print_load_stats("load", archive.Stats());
+		print_validation_report(archive.Report(), archive.Stats().validate_ms);
+		print_timeline_memory(timeline, archive);
+		std::cout << "canvas: " << format.width << "x" << format.height << ", " << format.ColorCount() << " colors" << std::endl;
 
-		std::string name = "place";
-		BitMap bmp(name, 1000, 1000);
-		if (diffs.size() > 0)
+		if (!packed_path.empty())
+			return pack_archive(archive, format, packed_path);
+
+		int result = 0;
+		if (seek_report)
 		{
-			auto start_time = 0;
-			if (diffs[0].size() > 0)
-				start_time = diffs[0][0].timestamp;
+			WithPaletteSize(format.ColorCount(), [&](auto palette_size) { result = report_seek_latency<decltype(palette_size)::value>(timeline, format); });
+			return result;
+		}
 
-			const double total_steps = static_cast<double>(diffs.size());
-			for (auto step = 0; step < total_steps; ++step)
-			{
-				if (step % 100 == 0)
-					print_progress(step, total_steps, 1);
+		if (kernel_report)
+		{
+			WithPaletteSize(format.ColorCount(), [&](auto palette_size) { result = report_kernels<decltype(palette_size)::value>(timeline, format); });
+			return result;
+		}
 
-				const auto& diff_step = diffs[step];
-				if (diff_step.size() > 0)
-				{
-					auto relative_time = diff_step[0].timestamp - start_time;
-					bmp.SetName(name + std::to_string(relative_time));
-					bmp.Update(diff_step);
-					bmp.Write();
-				}
-			}
+		// activity, pixel history and tiles store 4 bit colors
+		if ((heatmap || pixel_index || region) && format.ColorCount() > PlaceCanvas::palette_size)
+		{
+			std::cout << "--heatmap, --pixel-index and --region need a palette of at most " << PlaceCanvas::palette_size << " colors" << std::endl;
+			return 1;
 		}
+
+		if (heatmap)
+			return write_heatmap(timeline, format, heatmap_t0, heatmap_t1, thread_count);
+
+		if (pixel_index)
+			return report_pixel_history(timeline, format, diffs_path, thread_count);
+
+		if (region)
+			return write_region(timeline, format, region_rect[0], region_rect[1], region_rect[2], region_rect[3], region_time, thread_count);
+
+		// enough buffers that every render thread can fill one while the writers are busy
+		if (buffer_count == 0)
+			buffer_count = 2 * thread_count + writer_count;
+
+		std::unique_ptr<FrameWriter> writer;
+		if (writer_count > 0)
+			writer.reset(new FrameWriter(writer_count, buffer_count));
+
+		const auto export_start = std::chrono::steady_clock::now();
+		const std::string name = "place";
+		uint64_t frame_count = timeline.StepCount();
+		WithPaletteSize(format.ColorCount(), [&](auto palette_size)
+		{
+			if (interval > 0)
+				export_intervals<decltype(palette_size)::value>(timeline, format, name, level, writer.get(), interval);
+			else
+				export_frames<decltype(palette_size)::value>(timeline, format, name, level, writer.get(), thread_count);
+		});
+
+		if (writer)
+		{
+			const bool written = writer->Close();
+			const FrameWriterStats& stats = writer->Stats();
+			std::cout << std::endl << "writers: " << stats.frames << " frames, " << stats.bytes / (1024.0 * 1024.0) << " MB, "
+				<< writer_count << " threads busy " << stats.write_ms << " ms, render stalled " << stats.stall_ms << " ms on "
+				<< buffer_count << " buffers" << std::endl;
+			if (!written)
+				std::cout << stats.failed << " frames could not be written!" << std::endl;
+		}
+		if (interval > 0)
+			frame_count = (timeline.Step(timeline.StepCount() - 1).Timestamp() - timeline.Step(0).Timestamp()) / interval + 1;
+		std::cout << "export: " << frame_count << " frames in " << elapsed_ms(export_start) << " ms" << std::endl;
 	}
 	else
 	{
@@ -399,4 +1000,3 @@ int main()
 	}
 	return 0;
 }
-
@@ -0,0 +1,181 @@
+#pragma once
+
+#include "bitmap.h"
+#include "diff_timeline.h"
+#include "parallel.h"
+#include "place_canvas.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <inttypes.h>
+
+// per pixel activity over a time window: how often the pixel was written, when it was
+// last written and which color was placed on it most often
+class ActivityMap
+{
+public:
+	static const uint8_t no_color = 0xFF;	// dominant color of a pixel nobody wrote to
+	static const uint32_t heat_levels = PlaceCanvas::palette_size;
+
+	ActivityMap()
+		: m_Width(0)
+		, m_Height(0)
+		, m_RecordCount(0)
+		, m_MaxChangeCount(0)
+	{
+	}
+
+	// color counts of the rows being aggregated, for all workers together
+	static const uint64_t color_count_budget = 64 * 1024 * 1024;
+
+	// aggregates every record with t0 <= timestamp <= t1. the canvas is split into bands of rows and
+	// every worker owns whole bands: it scans the window once per band, counts the records that land
+	// in it straight into the result and picks the band's dominant colors before moving on. no two
+	// threads write the same pixel, nothing is reduced afterwards, and the color counts of the bands
+	// in flight stay within color_count_budget however many workers there are
+	void Build(const DiffTimeline& timeline, int32_t width, int32_t height, uint32_t t0, uint32_t t1, uint32_t thread_count = 0)
+	{
+		m_Width = width;
+		m_Height = height;
+
+		const uint64_t pixel_count = static_cast<uint64_t>(width) * height;
+		const uint64_t first_record = timeline.StepOffsets()[timeline.FindStep(t0)];
+		const uint64_t last_record = (t1 < UINT32_MAX) ? timeline.StepOffsets()[timeline.FindStep(t1 + 1)] : timeline.RecordCount();
+		m_RecordCount = (last_record > first_record) ? last_record - first_record : 0;
+
+		m_ChangeCounts.assign(static_cast<size_t>(pixel_count), 0);
+		m_LastChange.assign(static_cast<size_t>(pixel_count), 0);
+		m_DominantColors.assign(static_cast<size_t>(pixel_count), static_cast<uint8_t>(no_color));
+		m_MaxChangeCount = 0;
+		if (pixel_count == 0)
+			return;
+
+		// every worker rescans the window, never split finer than a few thousand records or a row each
+		uint32_t workers = thread_count > 0 ? thread_count : DefaultThreadCount();
+		workers = static_cast<uint32_t>((std::max)(static_cast<uint64_t>(1), (std::min)((std::min)(static_cast<uint64_t>(workers), m_RecordCount / 4096), static_cast<uint64_t>(height))));
+
+		// 64 bytes per pixel of color counts, as many rows per band as the budget allows each worker
+		const uint64_t row_bytes = static_cast<uint64_t>(width) * PlaceCanvas::palette_size * sizeof(uint32_t);
+		const uint64_t budget_rows = (std::max)(color_count_budget / workers / row_bytes, static_cast<uint64_t>(1));
+		const uint32_t band_rows = static_cast<uint32_t>((std::min)(budget_rows, (static_cast<uint64_t>(height) + workers - 1) / workers));
+		const uint32_t band_count = (static_cast<uint32_t>(height) + band_rows - 1) / band_rows;
+
+		const PlaceDiff* records = timeline.Records() + first_record;
+		const PlaceDiff* records_end = records + m_RecordCount;
+		std::vector<uint32_t> max_counts(workers, 0);
+		RunParallel(workers, [this, &max_counts, records, records_end, width, height, workers, band_rows, band_count](uint32_t worker)
+		{
+			// zeroed once, afterwards only the counts of the pixels a band touched are cleared again
+			std::vector<uint32_t> color_counts(static_cast<size_t>(static_cast<uint64_t>(band_rows) * width * PlaceCanvas::palette_size), 0);
+			for (uint32_t band = worker; band < band_count; band += workers)
+			{
+				const uint32_t first_row = band * band_rows;
+				const uint32_t row_count = (std::min)(band_rows, static_cast<uint32_t>(height) - first_row);
+				const uint64_t band_first = static_cast<uint64_t>(first_row) * width;
+				const uint64_t band_pixels = static_cast<uint64_t>(row_count) * width;
+
+				for (const PlaceDiff* diff = records; diff != records_end; ++diff)
+				{
+					if (diff->y - first_row >= row_count)
+						continue;
+
+					const uint64_t pixel = static_cast<uint64_t>(diff->y) * width + diff->x;
+					++color_counts[(pixel - band_first) * PlaceCanvas::palette_size + static_cast<uint32_t>(diff->color)];
+					++m_ChangeCounts[pixel];
+					if (diff->timestamp > m_LastChange[pixel])
+						m_LastChange[pixel] = diff->timestamp;
+				}
+
+				for (uint64_t pixel = 0; pixel < band_pixels; ++pixel)
+				{
+					const uint32_t changes = m_ChangeCounts[band_first + pixel];
+					if (changes == 0)
+						continue;
+
+					uint32_t* counts = color_counts.data() + pixel * PlaceCanvas::palette_size;
+					m_DominantColors[band_first + pixel] = static_cast<uint8_t>(std::max_element(counts, counts + PlaceCanvas::palette_size) - counts);
+					std::fill(counts, counts + PlaceCanvas::palette_size, 0u);
+					max_counts[worker] = (std::max)(max_counts[worker], changes);
+				}
+			}
+		});
+
+		m_MaxChangeCount = *std::max_element(max_counts.begin(), max_counts.end());
+	}
+
+	uint32_t ChangeCount(uint32_t x, uint32_t y) const		{ return m_ChangeCounts[Pixel(x, y)]; }
+	uint32_t LastChange(uint32_t x, uint32_t y) const		{ return m_LastChange[Pixel(x, y)]; }
+	uint8_t DominantColor(uint32_t x, uint32_t y) const		{ return m_DominantColors[Pixel(x, y)]; }
+	uint32_t MaxChangeCount() const							{ return m_MaxChangeCount; }
+	uint64_t RecordCount() const							{ return m_RecordCount; }
+
+	// change counts on a log scale, level 0 is untouched and the busiest pixel gets the top level
+	void RenderHeat(PlaceCanvas& canvas) const
+	{
+		const double scale = (m_MaxChangeCount > 0) ? (heat_levels - 2) / std::log(static_cast<double>(m_MaxChangeCount) + 1.0) : 0.0;
+		for (int32_t y = 0; y < m_Height; ++y)
+		{
+			for (int32_t x = 0; x < m_Width; ++x)
+			{
+				const uint32_t changes = m_ChangeCounts[Pixel(x, y)];
+				const uint8_t level = (changes == 0) ? 0 : static_cast<uint8_t>(1 + std::lround(std::log(changes + 1.0) * scale));
+				canvas.Set(x, y, (std::min)(level, static_cast<uint8_t>(heat_levels - 1)));
+			}
+		}
+	}
+
+	// dominant colors in the regular palette, untouched pixels stay white
+	void RenderDominant(PlaceCanvas& canvas) const
+	{
+		for (int32_t y = 0; y < m_Height; ++y)
+		{
+			for (int32_t x = 0; x < m_Width; ++x)
+			{
+				const uint8_t color = m_DominantColors[Pixel(x, y)];
+				canvas.Set(x, y, (color == no_color) ? static_cast<uint8_t>(White) : color);
+			}
+		}
+	}
+
+	// black through blue, red and yellow to white, indexed by the levels of RenderHeat()
+	static void HeatPalette(BitMapColor (&palette)[PlaceCanvas::palette_size])
+	{
+		static const uint8_t stops[][3] =
+		{
+			{ 0x00, 0x00, 0x00 },
+			{ 0x20, 0x20, 0xC0 },
+			{ 0xE0, 0x20, 0x20 },
+			{ 0xFF, 0xD0, 0x00 },
+			{ 0xFF, 0xFF, 0xFF },
+		};
+		static const uint32_t stop_count = sizeof(stops) / sizeof(stops[0]);
+
+		palette[0] = BitMapColor(stops[0][0], stops[0][1], stops[0][2]);
+		for (uint32_t level = 1; level < PlaceCanvas::palette_size; ++level)
+		{
+			const double position = static_cast<double>(level - 1) * (stop_count - 1) / (PlaceCanvas::palette_size - 2);
+			const uint32_t stop = (std::min)(static_cast<uint32_t>(position), stop_count - 2);
+			const double blend = position - stop;
+			uint8_t rgb[3];
+			for (int channel = 0; channel < 3; ++channel)
+				rgb[channel] = static_cast<uint8_t>(stops[stop][channel] + (stops[stop + 1][channel] - stops[stop][channel]) * blend + 0.5);
+			// BitMapColor's members are laid out in file order, blue first
+			palette[level] = BitMapColor(rgb[2], rgb[1], rgb[0]);
+		}
+	}
+
+private:
+	uint64_t Pixel(uint32_t x, uint32_t y) const
+	{
+		return static_cast<uint64_t>(y) * m_Width + x;
+	}
+
+	int32_t					m_Width;
+	int32_t					m_Height;
+	uint64_t				m_RecordCount;
+	uint32_t				m_MaxChangeCount;
+	std::vector<uint32_t>	m_ChangeCounts;
+	std::vector<uint32_t>	m_LastChange;
+	std::vector<uint8_t>	m_DominantColors;
+};
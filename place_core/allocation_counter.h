@@ -0,0 +1,100 @@
+#pragma once
+
+#include "stage_trace.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <inttypes.h>
+
+// replaces the global operator new and delete, every form of them, with malloc and free
+// plus a count: per thread for the stage totals of stage_trace, and one process wide total
+// that steady state checks compare before and after. the replacements are defined here,
+// so exactly one translation unit of a program includes this header.
+// gcc inlines the replacements into the code that calls them and then warns that memory
+// from operator new is released with free(), keeping them out of line avoids that.
+namespace allocation_counter
+{
+	inline std::atomic<uint64_t>& Total()
+	{
+		static std::atomic<uint64_t> total(0);
+		return total;
+	}
+
+	// allocations made on any thread so far
+	inline uint64_t Count()
+	{
+		return Total().load(std::memory_order_relaxed);
+	}
+
+	inline void* Allocate(std::size_t size) noexcept
+	{
+		stage_trace::CountAllocation();
+		Total().fetch_add(1, std::memory_order_relaxed);
+		return std::malloc(size > 0 ? size : 1);
+	}
+}
+
+#if defined(__GNUC__)
+#define ALLOCATION_COUNTER_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define ALLOCATION_COUNTER_NOINLINE __declspec(noinline)
+#else
+#define ALLOCATION_COUNTER_NOINLINE
+#endif
+
+ALLOCATION_COUNTER_NOINLINE void* operator new(std::size_t size)
+{
+	if (void* block = allocation_counter::Allocate(size))
+		return block;
+	throw std::bad_alloc();
+}
+
+ALLOCATION_COUNTER_NOINLINE void* operator new[](std::size_t size)
+{
+	if (void* block = allocation_counter::Allocate(size))
+		return block;
+	throw std::bad_alloc();
+}
+
+ALLOCATION_COUNTER_NOINLINE void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return allocation_counter::Allocate(size);
+}
+
+ALLOCATION_COUNTER_NOINLINE void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return allocation_counter::Allocate(size);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete(void* block) noexcept
+{
+	std::free(block);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete[](void* block) noexcept
+{
+	std::free(block);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete(void* block, std::size_t) noexcept
+{
+	std::free(block);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete[](void* block, std::size_t) noexcept
+{
+	std::free(block);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete(void* block, const std::nothrow_t&) noexcept
+{
+	std::free(block);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete[](void* block, const std::nothrow_t&) noexcept
+{
+	std::free(block);
+}
+
+#undef ALLOCATION_COUNTER_NOINLINE
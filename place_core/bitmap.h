@@ -0,0 +1,259 @@
+#pragma once
+
+#include "bmp_expand.h"
+#include "bmp_format.h"
+#include "diff_timeline.h"
+#include "frame_file.h"
+#include "mip_pyramid.h"
+#include "place_canvas.h"
+#include "step_sorter.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+// a 24 bit bitmap of the canvas. pixels are kept as palette indices next to
+// an encoded copy of the whole .bmp file; Update and Revert patch the encoded
+// pixels they touch, so producing a frame never re-encodes the image.
+// the palette starts out as the 2017 one, extra entries of larger palettes white.
+template <uint32_t ColorCount>
+class BitMapCoreT
+{
+public:
+	BitMapCoreT(int32_t width, int32_t height, const std::string& name = "name")
+		: m_FileHeader(width, height)
+		, m_InfoHeader(width, height, 24)
+		, m_Canvas(width, height)
+		, m_Kernel(bmp_expand::Best())
+		, m_Name(name)
+		, m_Sorter(width, height)
+	{
+		for (uint32_t i = 0; i < ColorCount; ++i)
+			m_Palette[i] = BitMapColor(static_cast<DiffColor>(i));
+		BuildTables();
+
+		// the headers never change, write them once
+		m_Stride = InitBitMapBuffer(width, height, m_Encoded);
+		m_PixelOffset = sizeof(m_FileHeader) + sizeof(m_InfoHeader);
+		EncodePixels();
+		m_BatchThreshold = m_Sorter.Threshold(m_Encoded.size());
+		if (m_BatchThreshold != SIZE_MAX)
+			m_Sorter.Reserve();
+	}
+
+	// reuses the name's storage, naming every frame of an export does not allocate
+	void SetName(const std::string& name)
+	{
+		m_Name.assign(name).append(".bmp");
+	}
+
+	const std::string& Name() const
+	{
+		return m_Name;
+	}
+
+	// timestep can be a whole range of steps. from BatchThreshold() records on it is
+	// sorted by row first, see StepSorter
+	void Update(const DiffStep& timestep)
+	{
+		if (timestep.size() < m_BatchThreshold)
+			Draw(timestep);
+		else
+			m_Sorter.ForEachSlice(timestep, [this](const DiffStep& sorted) { Draw(sorted); });
+	}
+
+	void Revert(const DiffStep& timestep, const uint8_t* prior_colors)
+	{
+		if (m_pPyramid)
+		{
+			MipPyramidT<ColorCount>& pyramid = *m_pPyramid;
+			m_Canvas.Revert(timestep, prior_colors, [&pyramid](uint32_t x, uint32_t y, uint8_t old_index, uint8_t new_index)
+			{
+				pyramid.Update(x, y, old_index, new_index);
+			});
+		}
+		else
+		{
+			m_Canvas.Revert(timestep, prior_colors);
+		}
+
+		PatchPixels(timestep);
+	}
+
+	// the encoded .bmp file, always in sync with the canvas
+	const std::vector<char>& GenerateBMPData() const
+	{
+		return m_Encoded;
+	}
+
+	// also keeps the 1/2, 1/4 and 1/8 scale images up to date from now on
+	void EnablePyramid()
+	{
+		m_pPyramid.reset(new MipPyramidT<ColorCount>(m_InfoHeader.Width(), m_InfoHeader.Height(), m_Tables));
+		m_pPyramid->Reset(m_Canvas);
+	}
+
+	// the encoded image at 1 / 2^level scale, level 0 is GenerateBMPData() and
+	// the others need EnablePyramid()
+	const std::vector<char>& GenerateBMPData(uint32_t level) const
+	{
+		return (level == 0 || !m_pPyramid) ? m_Encoded : m_pPyramid->Encoded(level);
+	}
+
+	const MipPyramidT<ColorCount>* Pyramid() const
+	{
+		return m_pPyramid.get();
+	}
+
+	bool Write(const std::string& file_path = std::string(), uint32_t level = 0) const
+	{
+		const std::string& path = file_path.length() > 0 ? file_path : m_Name;
+		return m_File.Write(path, GenerateBMPData(level));
+	}
+
+	const PlaceCanvasT<ColorCount>& Canvas() const
+	{
+		return m_Canvas;
+	}
+
+	// replaces every pixel, the only operation that re-encodes the whole image
+	void SetCanvas(const PlaceCanvasT<ColorCount>& canvas)
+	{
+		m_Canvas = canvas;
+		EncodePixels();
+		if (m_pPyramid)
+			m_pPyramid->Reset(m_Canvas);
+	}
+
+	// draws the canvas indices with different colors, re-encodes the whole image
+	void SetPalette(const BitMapColor (&palette)[ColorCount])
+	{
+		std::copy(palette, palette + ColorCount, m_Palette);
+		OnPaletteChanged();
+	}
+
+	// same for a palette read at runtime, entries past its end draw white
+	void SetPalette(const std::vector<BitMapColor>& palette)
+	{
+		for (uint32_t i = 0; i < ColorCount; ++i)
+			m_Palette[i] = (i < palette.size()) ? palette[i] : BitMapColor();
+		OnPaletteChanged();
+	}
+
+	// row expansion used by full encodes, defaults to the fastest one the cpu supports
+	void SetKernel(BmpKernel kernel)
+	{
+		m_Kernel = kernel;
+	}
+
+	BmpKernel Kernel() const
+	{
+		return m_Kernel;
+	}
+
+	// smallest step Update() sorts, 0 sorts every step and SIZE_MAX none. defaults to
+	// StepSorter::Threshold() of the encoded image
+	void SetBatchThreshold(size_t records)
+	{
+		m_BatchThreshold = records;
+	}
+
+	size_t BatchThreshold() const
+	{
+		return m_BatchThreshold;
+	}
+
+private:
+	void Draw(const DiffStep& writes)
+	{
+		if (m_pPyramid)
+		{
+			MipPyramidT<ColorCount>& pyramid = *m_pPyramid;
+			m_Canvas.Apply(writes, [&pyramid](uint32_t x, uint32_t y, uint8_t old_index, uint8_t new_index)
+			{
+				pyramid.Update(x, y, old_index, new_index);
+			});
+		}
+		else
+		{
+			m_Canvas.Apply(writes);
+		}
+
+		PatchPixels(writes);
+	}
+
+	void OnPaletteChanged()
+	{
+		BuildTables();
+		EncodePixels();
+		if (m_pPyramid)
+			EnablePyramid();
+	}
+
+	void BuildTables()
+	{
+		for (uint32_t i = 0; i < ColorCount; ++i)
+		{
+			const auto& bgr = reinterpret_cast<const uint8_t*>(&m_Palette[i]);
+			m_Tables.byte0[i] = bgr[0];
+			m_Tables.byte1[i] = bgr[1];
+			m_Tables.byte2[i] = bgr[2];
+		}
+	}
+
+	// expands every palette index to BGR, bottom row first as .bmp stores it
+	void EncodePixels()
+	{
+		const auto height = m_InfoHeader.Height();
+		const auto width = m_InfoHeader.Width();
+		const auto row_bytes = sizeof(BitMapColor) * width;
+		for (int32_t row = 0; row < height; ++row)
+		{
+			char* dest = m_Encoded.data() + RowOffset(row);
+			bmp_expand::ExpandRow(m_Kernel, m_Canvas.Row(row), width, m_Tables, dest);
+
+			// pad each row to ensure 4 byte alignment
+			std::fill(dest + row_bytes, dest + m_Stride, static_cast<char>(0));
+		}
+	}
+
+	// re-encodes the pixels a step wrote, with whatever color the canvas now holds
+	void PatchPixels(const DiffStep& timestep)
+	{
+		for (const auto& pixel : timestep)
+		{
+			char* dest = m_Encoded.data() + RowOffset(pixel.y) + pixel.x * sizeof(BitMapColor);
+			CopyColor(m_Palette[m_Canvas.Get(pixel.x, pixel.y)], dest);
+		}
+	}
+
+	size_t RowOffset(int32_t row) const
+	{
+		return m_PixelOffset + static_cast<size_t>(m_InfoHeader.Height() - 1 - row) * m_Stride;
+	}
+
+	static char* CopyColor(const BitMapColor& rgb, char* dest)
+	{
+		const auto& rgb_begin = reinterpret_cast<const char*>(&rgb);
+		return std::copy(rgb_begin, rgb_begin + sizeof(rgb), dest);
+	}
+
+	BitMapFileHeader	m_FileHeader;
+	BitMapInfoHeader	m_InfoHeader;
+	BitMapColor			m_Palette[ColorCount];
+	BmpExpandTablesT<ColorCount>	m_Tables;
+	PlaceCanvasT<ColorCount>		m_Canvas;
+	std::vector<char>	m_Encoded;
+	size_t				m_Stride;
+	size_t				m_PixelOffset;
+	BmpKernel			m_Kernel;
+	std::unique_ptr<MipPyramidT<ColorCount>>	m_pPyramid;
+	std::string			m_Name;
+	mutable FrameFile	m_File;		// writing a frame doesn't change the bitmap
+	StepSorter			m_Sorter;
+	size_t				m_BatchThreshold;
+};
+
+using BitMapCore = BitMapCoreT<16>;
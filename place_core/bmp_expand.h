@@ -0,0 +1,345 @@
+#pragma once
+
+#include <inttypes.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BMP_EXPAND_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// the intrinsics can only be compiled as native code, keep them out of /clr
+#ifdef _M_CEE
+#pragma managed(push, off)
+#endif
+
+// msvc compiles any intrinsic without flags, gcc and clang need the target per function
+#if defined(BMP_EXPAND_X86) && !defined(_MSC_VER)
+#define BMP_EXPAND_TARGET(isa) __attribute__((target(isa)))
+#else
+#define BMP_EXPAND_TARGET(isa)
+#endif
+
+// palette split into one table per output byte, the layout pshufb looks up from
+// in 16 entry halves
+template <uint32_t ColorCount>
+class BmpExpandTablesT
+{
+public:
+	uint8_t	byte0[ColorCount];	// blue
+	uint8_t	byte1[ColorCount];	// green
+	uint8_t	byte2[ColorCount];	// red
+};
+
+using BmpExpandTables = BmpExpandTablesT<16>;
+
+enum class BmpKernel
+{
+	Scalar,
+	Ssse3,
+	Avx2
+};
+
+namespace bmp_expand
+{
+	inline const char* Name(BmpKernel kernel)
+	{
+		switch (kernel)
+		{
+			default:
+			case BmpKernel::Scalar:	return "scalar";
+			case BmpKernel::Ssse3:	return "ssse3";
+			case BmpKernel::Avx2:	return "avx2";
+		}
+	}
+
+	inline bool Supported(BmpKernel kernel)
+	{
+#ifdef BMP_EXPAND_X86
+#ifdef _MSC_VER
+		int regs[4];
+		__cpuid(regs, 0);
+		const int max_leaf = regs[0];
+		__cpuid(regs, 1);
+		const bool ssse3 = (regs[2] & (1 << 9)) != 0;
+		// avx2 also needs the os to save the ymm registers
+		const bool os_ymm = (regs[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+		bool avx2 = false;
+		if (max_leaf >= 7 && os_ymm)
+		{
+			__cpuidex(regs, 7, 0);
+			avx2 = (regs[1] & (1 << 5)) != 0;
+		}
+#else
+		const bool ssse3 = __builtin_cpu_supports("ssse3") != 0;
+		const bool avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+		switch (kernel)
+		{
+			case BmpKernel::Scalar:	return true;
+			case BmpKernel::Ssse3:	return ssse3;
+			case BmpKernel::Avx2:	return avx2;
+		}
+		return false;
+#else
+		return kernel == BmpKernel::Scalar;
+#endif
+	}
+
+	// fastest kernel this cpu runs, checked once
+	inline BmpKernel Best()
+	{
+		static const BmpKernel best = Supported(BmpKernel::Avx2) ? BmpKernel::Avx2
+			: Supported(BmpKernel::Ssse3) ? BmpKernel::Ssse3 : BmpKernel::Scalar;
+		return best;
+	}
+
+	// expands pixels [first, width) of a packed 4 bit row, even pixels in the low nibble
+	inline void ExpandScalar(const uint8_t* indices, int32_t first, int32_t width, const BmpExpandTables& tables, char* dest)
+	{
+		dest += first * 3;
+		for (int32_t col = first; col < width; ++col)
+		{
+			const uint8_t packed = indices[col >> 1];
+			const uint8_t index = (col & 1) ? (packed >> 4) : (packed & 0x0F);
+			*dest++ = static_cast<char>(tables.byte0[index]);
+			*dest++ = static_cast<char>(tables.byte1[index]);
+			*dest++ = static_cast<char>(tables.byte2[index]);
+		}
+	}
+
+	// expands pixels [first, width) of a row of byte indices
+	inline void ExpandScalar(const uint8_t* indices, int32_t first, int32_t width, const BmpExpandTablesT<32>& tables, char* dest)
+	{
+		dest += first * 3;
+		for (int32_t col = first; col < width; ++col)
+		{
+			const uint8_t index = indices[col];
+			*dest++ = static_cast<char>(tables.byte0[index]);
+			*dest++ = static_cast<char>(tables.byte1[index]);
+			*dest++ = static_cast<char>(tables.byte2[index]);
+		}
+	}
+
+#ifdef BMP_EXPAND_X86
+	// pshufb masks that interleave 16 blue, green and red bytes into 48 bytes of bgr.
+	// [chunk][plane] takes output byte i of the chunk from pixel (chunk * 16 + i) / 3 of
+	// that plane when (chunk * 16 + i) % 3 == plane, -1 zeroes the byte
+	alignas(16) static const int8_t interleave_masks[3][3][16] =
+	{
+		{
+			{  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1, -1,  5 },
+			{ -1,  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1, -1 },
+			{ -1, -1,  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1 }
+		},
+		{
+			{ -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1, 10, -1 },
+			{  5, -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1, 10 },
+			{ -1,  5, -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1 }
+		},
+		{
+			{ -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1 },
+			{ -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1 },
+			{ 10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15 }
+		}
+	};
+
+	inline __m128i InterleaveMask(int chunk, int plane)
+	{
+		return _mm_load_si128(reinterpret_cast<const __m128i*>(interleave_masks[chunk][plane]));
+	}
+
+	// 8 packed bytes -> 16 indices in pixel order
+	BMP_EXPAND_TARGET("ssse3")
+	inline __m128i UnpackNibbles(__m128i packed)
+	{
+		const __m128i low_mask = _mm_set1_epi8(0x0F);
+		const __m128i low = _mm_and_si128(packed, low_mask);
+		const __m128i high = _mm_and_si128(_mm_srli_epi16(packed, 4), low_mask);
+		return _mm_unpacklo_epi8(low, high);
+	}
+
+	BMP_EXPAND_TARGET("ssse3")
+	inline void LoadMasks(__m128i (&masks)[3][3])
+	{
+		for (int chunk = 0; chunk < 3; ++chunk)
+			for (int plane = 0; plane < 3; ++plane)
+				masks[chunk][plane] = InterleaveMask(chunk, plane);
+	}
+
+	// interleaves 16 blue, green and red bytes into 48 bytes of bgr at dest
+	BMP_EXPAND_TARGET("ssse3")
+	inline void StoreBgr(__m128i b, __m128i g, __m128i r, const __m128i (&masks)[3][3], char* dest)
+	{
+		__m128i* out = reinterpret_cast<__m128i*>(dest);
+		for (int chunk = 0; chunk < 3; ++chunk)
+		{
+			const __m128i bgr = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, masks[chunk][0]),
+				_mm_shuffle_epi8(g, masks[chunk][1])), _mm_shuffle_epi8(r, masks[chunk][2]));
+			_mm_storeu_si128(out + chunk, bgr);
+		}
+	}
+
+	// 32 entry lookup, pshufb only sees the low 4 bits so indices 16 and up take the high half's result
+	BMP_EXPAND_TARGET("ssse3")
+	inline __m128i Lookup32(__m128i low_table, __m128i high_table, __m128i index)
+	{
+		const __m128i high = _mm_cmpgt_epi8(index, _mm_set1_epi8(15));
+		return _mm_or_si128(_mm_andnot_si128(high, _mm_shuffle_epi8(low_table, index)), _mm_and_si128(high, _mm_shuffle_epi8(high_table, index)));
+	}
+
+	BMP_EXPAND_TARGET("ssse3")
+	inline void ExpandSsse3(const uint8_t* indices, int32_t width, const BmpExpandTables& tables, char* dest)
+	{
+		__m128i masks[3][3];
+		LoadMasks(masks);
+
+		const __m128i byte0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.byte0));
+		const __m128i byte1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.byte1));
+		const __m128i byte2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.byte2));
+
+		int32_t col = 0;
+		for (; col + 16 <= width; col += 16)
+		{
+			const __m128i index = UnpackNibbles(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(indices + col / 2)));
+			StoreBgr(_mm_shuffle_epi8(byte0, index), _mm_shuffle_epi8(byte1, index), _mm_shuffle_epi8(byte2, index), masks, dest + col * 3);
+		}
+
+		ExpandScalar(indices, col, width, tables, dest);
+	}
+
+	BMP_EXPAND_TARGET("ssse3")
+	inline void ExpandSsse3(const uint8_t* indices, int32_t width, const BmpExpandTablesT<32>& tables, char* dest)
+	{
+		__m128i masks[3][3];
+		LoadMasks(masks);
+
+		__m128i planes[3][2];
+		const uint8_t* plane_tables[3] = { tables.byte0, tables.byte1, tables.byte2 };
+		for (int plane = 0; plane < 3; ++plane)
+		{
+			planes[plane][0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(plane_tables[plane]));
+			planes[plane][1] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(plane_tables[plane] + 16));
+		}
+
+		int32_t col = 0;
+		for (; col + 16 <= width; col += 16)
+		{
+			const __m128i index = _mm_loadu_si128(reinterpret_cast<const __m128i*>(indices + col));
+			StoreBgr(Lookup32(planes[0][0], planes[0][1], index), Lookup32(planes[1][0], planes[1][1], index),
+				Lookup32(planes[2][0], planes[2][1], index), masks, dest + col * 3);
+		}
+
+		ExpandScalar(indices, col, width, tables, dest);
+	}
+
+	BMP_EXPAND_TARGET("avx2")
+	inline void LoadMasks(__m256i (&masks)[3][3])
+	{
+		for (int chunk = 0; chunk < 3; ++chunk)
+			for (int plane = 0; plane < 3; ++plane)
+				masks[chunk][plane] = _mm256_broadcastsi128_si256(InterleaveMask(chunk, plane));
+	}
+
+	// lane 0 holds pixels 0-15 and lane 1 pixels 16-31 of each plane, writes their 96 bytes of bgr
+	BMP_EXPAND_TARGET("avx2")
+	inline void StoreBgr(__m256i b, __m256i g, __m256i r, const __m256i (&masks)[3][3], char* dest)
+	{
+		__m256i bgr[3];
+		for (int chunk = 0; chunk < 3; ++chunk)
+			bgr[chunk] = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(b, masks[chunk][0]),
+				_mm256_shuffle_epi8(g, masks[chunk][1])), _mm256_shuffle_epi8(r, masks[chunk][2]));
+
+		// each lane produced 48 contiguous bytes as three 16 byte chunks, put them back in order
+		__m256i* out = reinterpret_cast<__m256i*>(dest);
+		_mm256_storeu_si256(out + 0, _mm256_permute2x128_si256(bgr[0], bgr[1], 0x20));
+		_mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(bgr[2], bgr[0], 0x30));
+		_mm256_storeu_si256(out + 2, _mm256_permute2x128_si256(bgr[1], bgr[2], 0x31));
+	}
+
+	BMP_EXPAND_TARGET("avx2")
+	inline __m256i Lookup32(__m256i low_table, __m256i high_table, __m256i index)
+	{
+		const __m256i high = _mm256_cmpgt_epi8(index, _mm256_set1_epi8(15));
+		return _mm256_blendv_epi8(_mm256_shuffle_epi8(low_table, index), _mm256_shuffle_epi8(high_table, index), high);
+	}
+
+	BMP_EXPAND_TARGET("avx2")
+	inline void ExpandAvx2(const uint8_t* indices, int32_t width, const BmpExpandTables& tables, char* dest)
+	{
+		__m256i masks[3][3];
+		LoadMasks(masks);
+
+		const __m256i byte0 = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.byte0)));
+		const __m256i byte1 = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.byte1)));
+		const __m256i byte2 = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.byte2)));
+		const __m128i low_mask = _mm_set1_epi8(0x0F);
+
+		int32_t col = 0;
+		for (; col + 32 <= width; col += 32)
+		{
+			// lane 0 holds pixels 0-15, lane 1 pixels 16-31
+			const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(indices + col / 2));
+			const __m128i low = _mm_and_si128(packed, low_mask);
+			const __m128i high = _mm_and_si128(_mm_srli_epi16(packed, 4), low_mask);
+			const __m256i index = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(low, high)), _mm_unpackhi_epi8(low, high), 1);
+
+			StoreBgr(_mm256_shuffle_epi8(byte0, index), _mm256_shuffle_epi8(byte1, index), _mm256_shuffle_epi8(byte2, index), masks, dest + col * 3);
+		}
+
+		ExpandScalar(indices, col, width, tables, dest);
+	}
+
+	BMP_EXPAND_TARGET("avx2")
+	inline void ExpandAvx2(const uint8_t* indices, int32_t width, const BmpExpandTablesT<32>& tables, char* dest)
+	{
+		__m256i masks[3][3];
+		LoadMasks(masks);
+
+		__m256i planes[3][2];
+		const uint8_t* plane_tables[3] = { tables.byte0, tables.byte1, tables.byte2 };
+		for (int plane = 0; plane < 3; ++plane)
+		{
+			planes[plane][0] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(plane_tables[plane])));
+			planes[plane][1] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(plane_tables[plane] + 16)));
+		}
+
+		int32_t col = 0;
+		for (; col + 32 <= width; col += 32)
+		{
+			const __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + col));
+			StoreBgr(Lookup32(planes[0][0], planes[0][1], index), Lookup32(planes[1][0], planes[1][1], index),
+				Lookup32(planes[2][0], planes[2][1], index), masks, dest + col * 3);
+		}
+
+		ExpandScalar(indices, col, width, tables, dest);
+	}
+#endif
+
+	// expands one row of width palette indices, packed as the canvas of that palette size
+	// stores them, into width * 3 bytes of bgr
+	template <uint32_t ColorCount>
+	inline void ExpandRow(BmpKernel kernel, const uint8_t* indices, int32_t width, const BmpExpandTablesT<ColorCount>& tables, char* dest)
+	{
+		switch (kernel)
+		{
+#ifdef BMP_EXPAND_X86
+			case BmpKernel::Avx2:
+				ExpandAvx2(indices, width, tables, dest);
+				break;
+			case BmpKernel::Ssse3:
+				ExpandSsse3(indices, width, tables, dest);
+				break;
+#endif
+			default:
+				ExpandScalar(indices, 0, width, tables, dest);
+				break;
+		}
+	}
+}
+
+#ifdef _M_CEE
+#pragma managed(pop)
+#endif
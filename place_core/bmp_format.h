@@ -0,0 +1,156 @@
+#pragma once
+
+#include "place_diff.h"
+
+#include <algorithm>
+#include <vector>
+#include <inttypes.h>
+
+#pragma pack(push, 2)
+
+class BitMapColor
+{
+public:
+	BitMapColor()
+		: m_red(0xFF)
+		, m_green(0xFF)
+		, m_blue(0xFF)
+	{
+	}
+
+	BitMapColor(DiffColor diff_color)
+	{
+		uint32_t color = BitMapColor::Convert(diff_color);
+		m_blue	= (color & 0x00FF0000) >> 16;
+		m_green = (color & 0x0000FF00) >> 8;
+		m_red	= (color & 0x000000FF);
+	}
+
+	BitMapColor(uint8_t r, uint8_t g, uint8_t b)
+		: m_red(r)
+		, m_green(g)
+		, m_blue(b)
+	{
+	}
+
+	// 0xRRGGBB, the way palettes are written down
+	static BitMapColor FromRgb(uint32_t rgb)
+	{
+		// the members are laid out in file order, blue first, whatever their names say
+		return BitMapColor(rgb & 0xFF, (rgb >> 8) & 0xFF, (rgb >> 16) & 0xFF);
+	}
+
+	uint32_t Rgb() const
+	{
+		return (static_cast<uint32_t>(m_blue) << 16) | (static_cast<uint32_t>(m_green) << 8) | m_red;
+	}
+
+	static uint32_t Convert(DiffColor color)
+	{
+		switch (color)
+		{
+			default:
+			case White:			return 0xFFFFFF;
+			case Gray10:		return 0xE4E4E4;
+			case Gray50:		return 0x888888;
+			case Gray90:		return 0x222222;
+			case Pink:			return 0xFFA7D1;
+			case Red:			return 0xE50000;
+			case Orange:		return 0xE59500;
+			case DarkOrange:	return 0xA06A42;
+			case Yellow:		return 0xE5D900;
+			case LimeGreen:		return 0x94E044;
+			case Green:			return 0x02BE01;
+			case LightBlue:		return 0x00D3DD;
+			case MediumBlue:	return 0x0083C7;
+			case Blue:			return 0x0000EA;
+			case LightPurle:	return 0xCF6EE4;
+			case Purple:		return 0x820080;
+		}
+	}
+
+private:
+	uint8_t m_red;
+	uint8_t m_green;
+	uint8_t m_blue;
+};
+
+class BitMapInfoHeader
+{
+public:
+	BitMapInfoHeader() = delete;
+	BitMapInfoHeader(int32_t width, int32_t height, int8_t color_res = 24)
+		: m_Size(sizeof(BitMapInfoHeader))
+		, m_Width(width)				// width height (pixels)
+		, m_Height(height)				// image height (pixels)
+		, m_Planes(1)					// 1 plane
+		, m_ColorBitCount(color_res)	// 4 bit colot, 16 bit color, 24 bit color, etc...
+		, m_Compression(0)				// RGB
+		, m_SizeImage(height * ((width * sizeof(BitMapColor)) + ((4 - (width * sizeof(BitMapColor)) % 4) % 4))) // row count * (4 byte aligned column byte count)
+		, m_XPixelsPerM(0)
+		, m_YPixelsPerM(0)
+		, m_ColorUsed(0)
+		, m_ColorImportant(0)
+	{
+	}
+
+	int32_t Width()	 const { return m_Width; }
+	int32_t Height() const { return m_Height; }
+
+private:
+	uint32_t	m_Size;				// specifies the size of the BITMAPINFOHEADER structure, in bytes.
+	int32_t		m_Width;			// specifies the width of the image, in pixels.
+	int32_t		m_Height;			// specifies the height of the image, in pixels.
+	uint16_t	m_Planes;			// specifies the number of planes of the target device, must be set to zero.
+	uint16_t	m_ColorBitCount;	// specifies the number of bits per pixel - the color resolution. (1 = black/white, 4 = 16 colors, 8 = 256 colors, 24 = 16.7 million colors)
+	uint32_t	m_Compression;		// Specifies the type of compression, usually set to zero (no compression).
+	uint32_t	m_SizeImage;		// specifies the size of the image data, in bytes. If there is no compression, it is valid to set this member to zero.
+	int32_t		m_XPixelsPerM;		// specifies the the horizontal pixels per meter on the designated targer device, usually set to zero.
+	int32_t		m_YPixelsPerM;		// specifies the the vertical pixels per meter on the designated targer device, usually set to zero.
+	uint32_t	m_ColorUsed;		// specifies the number of colors used in the bitmap, if set to zero the number of colors is calculated using the biBitCount member.
+	uint32_t	m_ColorImportant;	// specifies the number of color that are 'important' for the bitmap, if set to zero, all colors are important.
+};
+
+class BitMapFileHeader
+{
+public:
+	BitMapFileHeader(int32_t width, int32_t height)
+		: m_Type(19778) // = 'B' + 'M' = bitmap
+		, m_FileSize(sizeof(BitMapFileHeader) + sizeof(BitMapInfoHeader) + (height * ((width * sizeof(BitMapColor)) + ((4 - (width * sizeof(BitMapColor)) % 4) % 4))))
+		, m_Reserved1(0)
+		, m_Reserved2(0)
+		, m_Offset(0)
+	{
+	}
+
+	uint32_t FileSize() const
+	{
+		return m_FileSize;
+	}
+
+private:
+	uint16_t m_Type;		// must always be set to 'BM' to declare that this is a .bmp-file.
+	uint32_t m_FileSize;	// specifies the total size of the bmp file in bytes.
+	uint16_t m_Reserved1;	// must always be set to zero.
+	uint16_t m_Reserved2;	// must always be set to zero.
+	uint32_t m_Offset;		// specifies the offset from the beginning of the file to the bitmap data.
+};
+
+#pragma pack(pop)
+
+// writes both headers of a width x height 24 bit bitmap into encoded, sized for the
+// headers and the padded rows, and returns the row stride in bytes
+inline size_t InitBitMapBuffer(int32_t width, int32_t height, std::vector<char>& encoded)
+{
+	const BitMapFileHeader file_header(width, height);
+	const BitMapInfoHeader info_header(width, height, 24);
+	const size_t row_bytes = sizeof(BitMapColor) * width;
+	const size_t stride = row_bytes + (4 - (row_bytes % 4)) % 4;
+	encoded.assign(sizeof(file_header) + sizeof(info_header) + stride * height, 0);
+
+	const auto& file_header_begin = reinterpret_cast<const char*>(&file_header);
+	std::copy(file_header_begin, file_header_begin + sizeof(file_header), encoded.begin());
+	const auto& info_header_begin = reinterpret_cast<const char*>(&info_header);
+	std::copy(info_header_begin, info_header_begin + sizeof(info_header), encoded.begin() + sizeof(file_header));
+	return stride;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "bmp_format.h"
+#include "packed_archive.h"
+#include "place_diff.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <inttypes.h>
+
+// size and palette of the canvas an archive is drawn on. raw diffs.bin files carry
+// neither, so they come from a text sidecar next to the archive (diffs.bin.meta):
+//
+//   width 2000
+//   height 2000
+//   palette FFFFFF E4E4E4 888888 ...
+//
+// packed archives store their size in the header, a sidecar still overrides it.
+// palette entry 0 is the color of a blank canvas, without a palette line or
+// sidecar the 2017 size and palette are used.
+class CanvasFormat
+{
+public:
+	static const uint32_t max_colors = 32;	// the largest palette the canvas and bitmap are specialized for
+
+	CanvasFormat()
+		: width(1000)
+		, height(1000)
+	{
+		for (uint32_t i = 0; i < 16; ++i)
+			palette.push_back(BitMapColor(static_cast<DiffColor>(i)));
+	}
+
+	static std::string SidecarPath(const std::string& archive_path)
+	{
+		return archive_path + ".meta";
+	}
+
+	// fails if the archive's header can't be read or its sidecar exists but is malformed
+	bool Load(const std::string& archive_path)
+	{
+		std::ifstream archive_file(archive_path, std::ios::in | std::ios::binary);
+		if (!archive_file.is_open())
+			return false;
+
+		PackedArchiveHeader header;
+		archive_file.read(reinterpret_cast<char*>(&header), sizeof(header));
+		if (archive_file.gcount() == sizeof(header) && packed_archive::IsPacked(reinterpret_cast<const uint8_t*>(&header), sizeof(header)))
+		{
+			width = static_cast<int32_t>(header.width);
+			height = static_cast<int32_t>(header.height);
+		}
+
+		std::ifstream sidecar(SidecarPath(archive_path));
+		return !sidecar.is_open() || Parse(sidecar);
+	}
+
+	bool Save(const std::string& sidecar_path) const
+	{
+		std::ofstream sidecar(sidecar_path, std::ios::out | std::ios::trunc);
+		if (!sidecar.is_open())
+			return false;
+
+		sidecar << "width " << width << std::endl << "height " << height << std::endl << "palette";
+		for (const BitMapColor& color : palette)
+			sidecar << " " << std::hex << std::uppercase << std::setw(6) << std::setfill('0') << color.Rgb() << std::dec;
+		sidecar << std::endl;
+		return sidecar.good();
+	}
+
+	bool IsDefault() const
+	{
+		const CanvasFormat standard;
+		if (width != standard.width || height != standard.height || palette.size() != standard.palette.size())
+			return false;
+		for (size_t i = 0; i < palette.size(); ++i)
+			if (palette[i].Rgb() != standard.palette[i].Rgb())
+				return false;
+		return true;
+	}
+
+	uint32_t ColorCount() const
+	{
+		return static_cast<uint32_t>(palette.size());
+	}
+
+	int32_t						width;
+	int32_t						height;
+	std::vector<BitMapColor>	palette;
+
+private:
+	bool Parse(std::istream& sidecar)
+	{
+		std::string line;
+		while (std::getline(sidecar, line))
+		{
+			std::istringstream fields(line);
+			std::string key;
+			if (!(fields >> key) || key[0] == '#')
+				continue;
+
+			if (key == "width" && !(fields >> width))
+				return false;
+			if (key == "height" && !(fields >> height))
+				return false;
+			if (key == "palette")
+			{
+				palette.clear();
+				std::string rgb;
+				while (fields >> rgb)
+				{
+					char* end = nullptr;
+					const unsigned long value = std::strtoul(rgb.c_str(), &end, 16);
+					if (rgb.size() != 6 || *end != '\0')
+						return false;
+					palette.push_back(BitMapColor::FromRgb(static_cast<uint32_t>(value)));
+				}
+			}
+		}
+
+		return width > 0 && height > 0 && palette.size() >= 2 && palette.size() <= max_colors;
+	}
+};
+
+// calls fn(std::integral_constant<uint32_t, N>()) with the smallest palette size N the canvas
+// and bitmap are specialized for that holds color_count colors, false if none does
+template <typename Fn>
+bool WithPaletteSize(uint32_t color_count, Fn&& fn)
+{
+	if (color_count <= 16)
+		fn(std::integral_constant<uint32_t, 16>());
+	else if (color_count <= 32)
+		fn(std::integral_constant<uint32_t, 32>());
+	else
+		return false;
+	return true;
+}
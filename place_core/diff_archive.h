@@ -0,0 +1,666 @@
+#pragma once
+
+#include "packed_archive.h"
+#include "place_diff.h"
+#include "stage_trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// read-only view of a whole file mapped into the address space
+class MappedFile
+{
+public:
+	MappedFile()
+#ifdef _WIN32
+		: m_File(INVALID_HANDLE_VALUE)
+		, m_Mapping(nullptr)
+#else
+		: m_File(-1)
+#endif
+		, m_Data(nullptr)
+		, m_Size(0)
+	{
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile()
+	{
+		Close();
+	}
+
+	bool Open(const std::string& path)
+	{
+		Close();
+
+#ifdef _WIN32
+		m_File = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_File == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(m_File, &file_size) || file_size.QuadPart == 0)
+		{
+			Close();
+			return false;
+		}
+
+		m_Mapping = CreateFileMappingA(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_Mapping == nullptr)
+		{
+			Close();
+			return false;
+		}
+
+		m_Data = static_cast<const uint8_t*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+		m_Size = static_cast<uint64_t>(file_size.QuadPart);
+#else
+		m_File = open(path.c_str(), O_RDONLY);
+		if (m_File < 0)
+			return false;
+
+		struct stat file_stat;
+		if (fstat(m_File, &file_stat) != 0 || file_stat.st_size == 0)
+		{
+			Close();
+			return false;
+		}
+
+		void* data = mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, m_File, 0);
+		m_Data = (data != MAP_FAILED) ? static_cast<const uint8_t*>(data) : nullptr;
+		m_Size = static_cast<uint64_t>(file_stat.st_size);
+#endif
+
+		if (m_Data == nullptr)
+		{
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (m_Data != nullptr)
+			UnmapViewOfFile(m_Data);
+		if (m_Mapping != nullptr)
+			CloseHandle(m_Mapping);
+		if (m_File != INVALID_HANDLE_VALUE)
+			CloseHandle(m_File);
+		m_File = INVALID_HANDLE_VALUE;
+		m_Mapping = nullptr;
+#else
+		if (m_Data != nullptr)
+			munmap(const_cast<uint8_t*>(m_Data), static_cast<size_t>(m_Size));
+		if (m_File >= 0)
+			close(m_File);
+		m_File = -1;
+#endif
+		m_Data = nullptr;
+		m_Size = 0;
+	}
+
+	bool			IsOpen() const	{ return m_Data != nullptr; }
+	const uint8_t*	Data() const	{ return m_Data; }
+	uint64_t		Size() const	{ return m_Size; }
+
+private:
+#ifdef _WIN32
+	HANDLE			m_File;
+	HANDLE			m_Mapping;
+#else
+	int				m_File;
+#endif
+	const uint8_t*	m_Data;
+	uint64_t		m_Size;
+};
+
+class DiffArchiveStats
+{
+public:
+	bool		mapped = false;		// records are read in place from the mapping
+	bool		packed = false;		// records were decoded from a packed (.plz) archive
+	uint64_t	file_bytes = 0;		// size of the archive on disk
+	uint64_t	record_count = 0;	// complete 16 byte records in the archive
+	uint64_t	step_count = 0;		// distinct timesteps found by the last ScanSteps()
+	double		open_ms = 0.0;		// time spent mapping or reading the file, summed over ReadNext() when streamed
+	double		scan_ms = 0.0;		// time spent finding timestep boundaries
+	double		validate_ms = 0.0;	// time spent checking records against the canvas, summed over ReadNext() when streamed
+};
+
+// what Validate() found. records off the canvas are quarantined: dropped from the archive,
+// the first few kept here as they were read. colors past the end of the palette are drawn
+// white and the record is rewritten to say so. the viewer always drew them white, the
+// generator used to write them black (0x000000) and now matches the viewer.
+class DiffValidationReport
+{
+public:
+	static const size_t max_quarantined = 16;
+
+	uint64_t				checked = 0;			// records validated
+	uint64_t				out_of_range = 0;		// records dropped for coordinates off the canvas
+	uint64_t				invalid_colors = 0;		// records whose color was replaced by white
+	std::vector<PlaceDiff>	quarantined;			// the first max_quarantined dropped records
+
+	bool Clean() const
+	{
+		return out_of_range == 0 && invalid_colors == 0;
+	}
+};
+
+// drops the records off a width x height canvas and whitens colors past color_count, counting
+// both in report. returns how many records are left, at the front of records
+inline uint64_t SanitizeRecords(PlaceDiff* records, uint64_t count, uint32_t width, uint32_t height, uint32_t color_count,
+	DiffValidationReport& report)
+{
+	uint64_t kept = 0;
+	for (uint64_t record = 0; record < count; ++record)
+	{
+		PlaceDiff diff = records[record];
+		if (diff.x >= width || diff.y >= height)
+		{
+			++report.out_of_range;
+			if (report.quarantined.size() < DiffValidationReport::max_quarantined)
+				report.quarantined.push_back(diff);
+			continue;
+		}
+
+		if (static_cast<uint32_t>(diff.color) >= color_count)
+		{
+			++report.invalid_colors;
+			diff.color = White;
+		}
+		records[kept++] = diff;
+	}
+
+	report.checked += count;
+	return kept;
+}
+
+// diffs.bin loader, exposes the records as one contiguous span of PlaceDiff.
+// the file is mapped read-only when possible so that no record is ever copied,
+// otherwise it is read into a single buffer with large block reads.
+// packed archives (see packed_archive.h) are recognised by their magic and
+// decoded block-parallel into the record buffer, callers see no difference.
+// a streamed archive is read one block per ReadNext() instead, so the first steps
+// can be used while the rest of the file is still on its way.
+// records are untrusted until Validate() has checked them against the canvas, after
+// that every record lies on it and has a palette color, so nothing downstream checks again.
+class DiffArchive
+{
+public:
+	enum class LoadMode
+	{
+		Mapped,
+		Buffered,
+		Streamed	// Open() only sizes the record buffer, ReadNext() fills it
+	};
+
+	DiffArchive()
+		: m_Records(nullptr)
+		, m_Count(0)
+		, m_Loaded(0)
+		, m_NextBlock(0)
+		, m_Validated(false)
+		, m_Width(0)
+		, m_Height(0)
+		, m_ColorCount(0)
+	{
+	}
+
+	DiffArchive(const DiffArchive&) = delete;
+	DiffArchive& operator=(const DiffArchive&) = delete;
+
+	// thread_count readers split a raw buffered archive into record aligned parts (0 = one per core)
+	bool Open(const std::string& path, LoadMode mode = LoadMode::Mapped, uint32_t thread_count = 1)
+	{
+		stage_trace::TraceScope trace("load");
+		Close();
+
+		const auto start = std::chrono::steady_clock::now();
+
+		if (mode == LoadMode::Streamed)
+		{
+			if (!OpenStreamed(path))
+				return false;
+		}
+		else if (mode == LoadMode::Mapped && m_File.Open(path))
+		{
+			if (packed_archive::IsPacked(m_File.Data(), m_File.Size()))
+			{
+				// the mapping is only needed while decoding
+				const bool decoded = DecodePacked(m_File.Data(), m_File.Size());
+				m_File.Close();
+				if (!decoded)
+					return false;
+			}
+			else
+			{
+				m_Records = reinterpret_cast<const PlaceDiff*>(m_File.Data());
+				m_Count = m_File.Size() / sizeof(PlaceDiff);
+				m_Loaded = m_Count;
+				m_Stats.mapped = true;
+				m_Stats.file_bytes = m_File.Size();
+			}
+		}
+		else if (!ReadBuffered(path, thread_count))
+		{
+			return false;
+		}
+
+		m_Stats.record_count = m_Count;
+		m_Stats.open_ms = ElapsedMs(start);
+		return true;
+	}
+
+	// reads the next block of a streamed archive, records [0, Loaded()) are final once it returns.
+	// false if the block can't be read or the archive is already complete
+	bool ReadNext()
+	{
+		static const uint64_t block_records = 64 * 1024;
+
+		if (Complete())
+			return false;
+
+		stage_trace::TraceScope trace("read");
+		const auto start = std::chrono::steady_clock::now();
+		PlaceDiff* dest = m_StreamBuffer.get() + m_Loaded;
+		uint64_t count = 0;
+		if (m_Stats.packed)
+		{
+			// blocks hold records_per_block records each, the next one starts right at m_Loaded
+			if (m_NextBlock >= m_PackedView.Header().block_count || m_PackedView.BlockRecordCount(m_NextBlock) > m_Count - m_Loaded)
+				return false;
+			count = m_PackedView.DecodeBlock(m_NextBlock++, dest);
+			if (count == 0)
+				return false;
+		}
+		else
+		{
+			count = (std::min)(block_records, m_Count - m_Loaded);
+			m_Stream.read(reinterpret_cast<char*>(dest), static_cast<std::streamsize>(count * sizeof(PlaceDiff)));
+			if (!m_Stream.good())
+				return false;
+		}
+
+		// the block lands in the owned stream buffer, quarantined records are squeezed out in place
+		m_Stats.open_ms += ElapsedMs(start);
+		if (m_Validated)
+		{
+			const auto validate_start = std::chrono::steady_clock::now();
+			const uint64_t kept = Sanitize(dest, count);
+			m_Count -= count - kept;
+			count = kept;
+			m_Stats.validate_ms += ElapsedMs(validate_start);
+		}
+
+		m_Loaded += count;
+		trace.SetItems(count);
+		if (Complete())
+		{
+			m_Stream.close();
+			m_File.Close();
+		}
+		return true;
+	}
+
+	void Close()
+	{
+		m_File.Close();
+		m_Stream.close();
+		m_Buffer.clear();
+		m_Buffer.shrink_to_fit();
+		m_StreamBuffer.reset();
+		m_PackedView = PackedArchiveView();
+		m_Records = nullptr;
+		m_Count = 0;
+		m_Loaded = 0;
+		m_NextBlock = 0;
+		m_Validated = false;
+		m_Report = DiffValidationReport();
+		m_Stats = DiffArchiveStats();
+	}
+
+	// the one pass that checks every record against a width x height canvas with color_count colors,
+	// see DiffValidationReport. a valid archive is checked on thread_count threads (0 = one per core)
+	// and left as it is; otherwise a mapped archive is copied out first and the records are compacted.
+	// streamed archives check what is loaded now and every block ReadNext() brings in later
+	void Validate(int32_t width, int32_t height, uint32_t color_count, uint32_t thread_count = 1)
+	{
+		stage_trace::TraceScope trace("validate", m_Loaded);
+		const auto start = std::chrono::steady_clock::now();
+		m_Width = static_cast<uint32_t>((std::max)(width, 0));
+		m_Height = static_cast<uint32_t>((std::max)(height, 0));
+		m_ColorCount = color_count;
+		m_Validated = true;
+		m_Report = DiffValidationReport();
+
+		if (m_Loaded > 0 && !AllValid(thread_count))
+		{
+			PlaceDiff* records = WritableRecords();
+			const uint64_t kept = Sanitize(records, m_Loaded);
+			m_Count -= m_Loaded - kept;
+			m_Loaded = kept;
+			if (!m_StreamBuffer)
+				m_Buffer.resize(static_cast<size_t>(kept));
+		}
+		else
+		{
+			m_Report.checked = m_Loaded;
+		}
+
+		m_Stats.record_count = m_Count;
+		m_Stats.validate_ms = ElapsedMs(start);
+	}
+
+	// calls fn(step_begin, step_end) for every run of records sharing a timestamp
+	template <typename StepFn>
+	uint64_t ScanSteps(StepFn&& fn)
+	{
+		const auto start = std::chrono::steady_clock::now();
+
+		uint64_t step_count = 0;
+		const PlaceDiff* step_begin = begin();
+		for (const PlaceDiff* diff = begin(); diff != end(); ++diff)
+		{
+			if (diff->timestamp != step_begin->timestamp)
+			{
+				fn(step_begin, diff);
+				step_begin = diff;
+				++step_count;
+			}
+		}
+
+		if (step_begin != end())
+		{
+			fn(step_begin, end());
+			++step_count;
+		}
+
+		m_Stats.step_count = step_count;
+		m_Stats.scan_ms = ElapsedMs(start);
+		return step_count;
+	}
+
+	// fills step_starts with the index of the first record of every step, the same steps ScanSteps()
+	// finds, on up to thread_count threads (0 = one per core). each thread scans a record aligned
+	// chunk and compares every record with the one before it, the first one's predecessor lying in
+	// the previous chunk, so a step spanning a chunk edge starts exactly once. the chunks' starts
+	// are then stitched together in order. on a mapped archive this also faults the pages in in parallel
+	uint64_t ScanStepStarts(std::vector<uint64_t>& step_starts, uint32_t thread_count = 1)
+	{
+		static const uint64_t min_chunk_records = 1024 * 1024;
+
+		const auto start = std::chrono::steady_clock::now();
+		const uint64_t count = m_Count;
+		const uint64_t max_workers = (std::max)(count / min_chunk_records, static_cast<uint64_t>(1));
+		const uint32_t workers = static_cast<uint32_t>((std::min)(static_cast<uint64_t>(thread_count > 0 ? thread_count : DefaultThreadCount()), max_workers));
+
+		std::vector<std::vector<uint64_t>> chunk_starts(workers);
+		const PlaceDiff* records = m_Records;
+		RunParallel(workers, [records, count, workers, &chunk_starts](uint32_t worker)
+		{
+			uint64_t first = 0;
+			uint64_t last = 0;
+			SplitRange(count, workers, worker, first, last);
+
+			std::vector<uint64_t>& starts = chunk_starts[worker];
+			for (uint64_t record = first; record < last; ++record)
+			{
+				if (record == 0 || records[record].timestamp != records[record - 1].timestamp)
+					starts.push_back(record);
+			}
+		});
+
+		uint64_t step_count = 0;
+		for (const auto& starts : chunk_starts)
+			step_count += starts.size();
+
+		// one spare slot for the end offset the timeline appends
+		step_starts.clear();
+		step_starts.reserve(static_cast<size_t>(step_count + 1));
+		for (const auto& starts : chunk_starts)
+			step_starts.insert(step_starts.end(), starts.begin(), starts.end());
+
+		m_Stats.step_count = step_count;
+		m_Stats.scan_ms = ElapsedMs(start);
+		return step_count;
+	}
+
+	// evicts the file from the OS page cache so the next Open() measures a cold load
+	static bool DropPageCache(const std::string& path)
+	{
+#ifdef _WIN32
+		// there is no unprivileged per-file eviction on windows
+		(void)path;
+		return false;
+#else
+		int file = open(path.c_str(), O_RDONLY);
+		if (file < 0)
+			return false;
+
+		bool dropped = posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED) == 0;
+		close(file);
+		return dropped;
+#endif
+	}
+
+	const PlaceDiff*		begin() const	{ return m_Records; }
+	const PlaceDiff*		end() const		{ return m_Records + m_Count; }
+	uint64_t				Count() const	{ return m_Count; }
+	uint64_t				Loaded() const	{ return m_Loaded; }		// records read so far, Count() unless streamed
+	bool					Complete() const { return m_Loaded == m_Count; }
+	bool					IsMapped() const { return m_Stats.mapped; }
+	bool					IsValidated() const { return m_Validated; }
+	const DiffValidationReport&	Report() const	{ return m_Report; }
+	const DiffArchiveStats&	Stats() const	{ return m_Stats; }
+
+private:
+	// raw archives are read through a stream, packed ones decoded block by block from the mapping.
+	// without a mapping the whole file is read up front and the archive starts out complete
+	bool OpenStreamed(const std::string& path)
+	{
+		if (!m_File.Open(path))
+		{
+			if (!ReadBuffered(path))
+				return false;
+			m_Loaded = m_Count;
+			return true;
+		}
+
+		if (packed_archive::IsPacked(m_File.Data(), m_File.Size()))
+		{
+			if (!m_PackedView.Open(m_File.Data(), m_File.Size()))
+				return false;
+			m_Count = m_PackedView.Header().record_count;
+			m_Stats.packed = true;
+			m_Stats.file_bytes = m_File.Size();
+		}
+		else
+		{
+			m_Stats.file_bytes = m_File.Size();
+			m_File.Close();
+			m_Stream.open(path, std::ios::in | std::ios::binary);
+			if (!m_Stream.is_open())
+				return false;
+			m_Count = m_Stats.file_bytes / sizeof(PlaceDiff);
+		}
+
+		// left uninitialized, only the records below m_Loaded are ever read
+		m_StreamBuffer.reset(new PlaceDiff[static_cast<size_t>(m_Count)]);
+		m_Records = m_StreamBuffer.get();
+		m_Loaded = 0;
+		m_NextBlock = 0;
+		return true;
+	}
+
+	bool ReadBuffered(const std::string& path, uint32_t thread_count = 1)
+	{
+		std::ifstream diffs_file(path, std::ios::in | std::ios::binary);
+		if (!diffs_file.is_open())
+			return false;
+
+		diffs_file.seekg(0, std::ios::end);
+		const uint64_t file_bytes = static_cast<uint64_t>(diffs_file.tellg());
+		diffs_file.seekg(0, std::ios::beg);
+
+		char magic[sizeof(packed_archive::magic)] = {};
+		diffs_file.read(magic, sizeof(magic));
+		diffs_file.seekg(0, std::ios::beg);
+		if (file_bytes >= sizeof(PackedArchiveHeader) && std::memcmp(magic, packed_archive::magic, sizeof(magic)) == 0)
+		{
+			std::vector<uint8_t> packed(static_cast<size_t>(file_bytes));
+			diffs_file.read(reinterpret_cast<char*>(packed.data()), static_cast<std::streamsize>(file_bytes));
+			return diffs_file.good() && DecodePacked(packed.data(), file_bytes);
+		}
+
+		m_Buffer.resize(static_cast<size_t>(file_bytes / sizeof(PlaceDiff)));
+		diffs_file.close();
+
+		// read in large blocks straight into the record buffer, every reader through its own
+		// stream into its own record aligned part, so reads overlap until the disk is saturated
+		static const uint64_t block_bytes = 4 * 1024 * 1024;
+		const uint64_t count = m_Buffer.size();
+		const uint64_t max_readers = (std::max)(count * sizeof(PlaceDiff) / block_bytes, static_cast<uint64_t>(1));
+		const uint32_t readers = static_cast<uint32_t>((std::min)(static_cast<uint64_t>(thread_count > 0 ? thread_count : DefaultThreadCount()), max_readers));
+		std::vector<uint8_t> parts_read(readers, 0);
+		PlaceDiff* records = m_Buffer.data();
+		RunParallel(readers, [&path, records, count, readers, &parts_read](uint32_t reader)
+		{
+			uint64_t first = 0;
+			uint64_t last = 0;
+			SplitRange(count, readers, reader, first, last);
+
+			std::ifstream part(path, std::ios::in | std::ios::binary);
+			part.seekg(static_cast<std::streamoff>(first * sizeof(PlaceDiff)), std::ios::beg);
+			char* dest = reinterpret_cast<char*>(records + first);
+			uint64_t remaining = (last - first) * sizeof(PlaceDiff);
+			while (remaining > 0 && part.good())
+			{
+				const uint64_t chunk = (remaining < block_bytes) ? remaining : block_bytes;
+				part.read(dest, static_cast<std::streamsize>(chunk));
+				dest += chunk;
+				remaining -= chunk;
+			}
+			parts_read[reader] = part.good() ? 1 : 0;
+		});
+
+		if (std::find(parts_read.begin(), parts_read.end(), 0) != parts_read.end())
+		{
+			m_Buffer.clear();
+			return false;
+		}
+
+		m_Records = m_Buffer.data();
+		m_Count = m_Buffer.size();
+		m_Loaded = m_Count;
+		m_Stats.mapped = false;
+		m_Stats.file_bytes = file_bytes;
+		return true;
+	}
+
+	bool IsValid(const PlaceDiff& diff) const
+	{
+		return diff.x < m_Width && diff.y < m_Height && static_cast<uint32_t>(diff.color) < m_ColorCount;
+	}
+
+	// whether every loaded record is valid, each thread checks a record aligned chunk
+	bool AllValid(uint32_t thread_count) const
+	{
+		static const uint64_t min_chunk_records = 1024 * 1024;
+
+		const uint64_t count = m_Loaded;
+		const uint64_t max_workers = (std::max)(count / min_chunk_records, static_cast<uint64_t>(1));
+		const uint32_t workers = static_cast<uint32_t>((std::min)(static_cast<uint64_t>(thread_count > 0 ? thread_count : DefaultThreadCount()), max_workers));
+		std::vector<uint8_t> chunk_valid(workers, 1);
+		RunParallel(workers, [this, count, workers, &chunk_valid](uint32_t worker)
+		{
+			uint64_t first = 0;
+			uint64_t last = 0;
+			SplitRange(count, workers, worker, first, last);
+
+			uint64_t invalid = 0;
+			for (uint64_t record = first; record < last; ++record)
+				invalid += IsValid(m_Records[record]) ? 0 : 1;
+			chunk_valid[worker] = (invalid == 0) ? 1 : 0;
+		});
+
+		return std::find(chunk_valid.begin(), chunk_valid.end(), 0) == chunk_valid.end();
+	}
+
+	// the records as a buffer Sanitize() may rewrite, a mapping is copied into m_Buffer first
+	PlaceDiff* WritableRecords()
+	{
+		if (m_StreamBuffer)
+			return m_StreamBuffer.get();
+
+		if (m_Stats.mapped)
+		{
+			m_Buffer.assign(m_Records, m_Records + m_Count);
+			m_File.Close();
+			m_Records = m_Buffer.data();
+			m_Stats.mapped = false;
+		}
+		return m_Buffer.data();
+	}
+
+	uint64_t Sanitize(PlaceDiff* records, uint64_t count)
+	{
+		return SanitizeRecords(records, count, m_Width, m_Height, m_ColorCount, m_Report);
+	}
+
+	bool DecodePacked(const uint8_t* data, uint64_t size)
+	{
+		PackedArchiveView view;
+		if (!view.Open(data, size))
+			return false;
+
+		view.DecodeAll(m_Buffer);
+		m_Records = m_Buffer.data();
+		m_Count = m_Buffer.size();
+		m_Loaded = m_Count;
+		m_Stats.mapped = false;
+		m_Stats.packed = true;
+		m_Stats.file_bytes = size;
+		return true;
+	}
+
+	static double ElapsedMs(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	MappedFile				m_File;
+	std::vector<PlaceDiff>	m_Buffer;
+	std::ifstream			m_Stream;			// raw archive being streamed
+	PackedArchiveView		m_PackedView;		// packed archive being streamed, over m_File
+	std::unique_ptr<PlaceDiff[]>	m_StreamBuffer;
+	const PlaceDiff*		m_Records;
+	uint64_t				m_Count;
+	uint64_t				m_Loaded;
+	uint64_t				m_NextBlock;
+	bool					m_Validated;
+	uint32_t				m_Width;
+	uint32_t				m_Height;
+	uint32_t				m_ColorCount;
+	DiffValidationReport	m_Report;
+	DiffArchiveStats		m_Stats;
+};
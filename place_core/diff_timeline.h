@@ -0,0 +1,196 @@
+#pragma once
+
+#include "diff_archive.h"
+#include "stage_trace.h"
+
+#include <algorithm>
+#include <vector>
+#include <inttypes.h>
+
+// the records of one timestep, a view into the timeline's record array
+class DiffStep
+{
+public:
+	DiffStep()
+		: m_Begin(nullptr)
+		, m_End(nullptr)
+	{
+	}
+
+	DiffStep(const PlaceDiff* begin, const PlaceDiff* end)
+		: m_Begin(begin)
+		, m_End(end)
+	{
+	}
+
+	const PlaceDiff*	begin() const	{ return m_Begin; }
+	const PlaceDiff*	end() const		{ return m_End; }
+	size_t				size() const	{ return static_cast<size_t>(m_End - m_Begin); }
+	bool				empty() const	{ return m_Begin == m_End; }
+	uint32_t			Timestamp() const { return m_Begin->timestamp; }
+
+private:
+	const PlaceDiff*	m_Begin;
+	const PlaceDiff*	m_End;
+};
+
+// compressed sparse row index over the diff records: one contiguous record
+// array plus the offset of the first record of every timestep. step i spans
+// [m_StepOffsets[i], m_StepOffsets[i + 1]), so fetching a step never allocates.
+// the records are not owned, the archive they come from must outlive the timeline.
+// a timeline over a streamed archive grows with Extend() as records come in.
+class DiffTimeline
+{
+public:
+	DiffTimeline()
+		: m_Records(nullptr)
+		, m_ScannedRecords(0)
+	{
+	}
+
+	// thread_count threads find the step boundaries, the timeline is the same for any count
+	// the archive must be validated, see DiffArchive::Validate()
+	bool Build(DiffArchive& archive, uint32_t thread_count = 1)
+	{
+		if (!archive.IsValidated())
+			return false;
+
+		stage_trace::TraceScope trace("scan", archive.Count());
+		m_Records = archive.begin();
+		archive.ScanStepStarts(m_StepOffsets, thread_count);
+		m_StepOffsets.push_back(archive.Count());
+		m_StepOffsets.shrink_to_fit();
+		m_ScannedRecords = archive.Count();
+
+		return StepCount() > 0;
+	}
+
+	// starts an empty timeline over the records of a validated, streamed archive, see Extend()
+	bool Start(const DiffArchive& archive)
+	{
+		if (!archive.IsValidated())
+			return false;
+
+		m_Records = archive.begin();
+		m_StepOffsets.assign(1, 0);
+		m_ScannedRecords = 0;
+		return true;
+	}
+
+	// adds the steps completed by the first loaded_records records. the last step stays
+	// open until a record with another timestamp arrives or complete says none will.
+	// returns the number of steps added, existing steps never change
+	uint64_t Extend(uint64_t loaded_records, bool complete)
+	{
+		stage_trace::TraceScope trace("scan", loaded_records - (std::min)(m_ScannedRecords, loaded_records));
+		const uint64_t known_steps = StepCount();
+
+		// m_StepOffsets.back() is where the open step begins
+		for (uint64_t record = (std::max)(m_ScannedRecords, static_cast<uint64_t>(1)); record < loaded_records; ++record)
+		{
+			if (m_Records[record].timestamp != m_Records[record - 1].timestamp)
+				m_StepOffsets.push_back(record);
+		}
+		m_ScannedRecords = (std::max)(m_ScannedRecords, loaded_records);
+
+		if (complete && m_ScannedRecords > m_StepOffsets.back())
+			m_StepOffsets.push_back(m_ScannedRecords);
+		if (complete)
+			m_StepOffsets.shrink_to_fit();
+
+		return StepCount() - known_steps;
+	}
+
+	DiffStep Step(uint64_t index) const
+	{
+		return DiffStep(m_Records + m_StepOffsets[index], m_Records + m_StepOffsets[index + 1]);
+	}
+
+	uint64_t StepCount() const
+	{
+		return m_StepOffsets.empty() ? 0 : m_StepOffsets.size() - 1;
+	}
+
+	uint64_t RecordCount() const
+	{
+		return m_StepOffsets.empty() ? 0 : m_StepOffsets.back();
+	}
+
+	// index of the first step at or after timestamp, StepCount() if there is none.
+	// steps are in archive order, which is ascending time for the r/place dumps
+	uint64_t FindStep(uint32_t timestamp) const
+	{
+		uint64_t first = 0;
+		uint64_t count = StepCount();
+		while (count > 0)
+		{
+			const uint64_t half = count / 2;
+			if (Step(first + half).Timestamp() < timestamp)
+			{
+				first += half + 1;
+				count -= half + 1;
+			}
+			else
+			{
+				count = half;
+			}
+		}
+		return first;
+	}
+
+	// calls fn(diff) for every record of steps [first_step, last_step), in order
+	template <typename DiffFn>
+	void ForEachRecord(uint64_t first_step, uint64_t last_step, DiffFn&& fn) const
+	{
+		const PlaceDiff* records_end = m_Records + m_StepOffsets[last_step];
+		for (const PlaceDiff* diff = m_Records + m_StepOffsets[first_step]; diff != records_end; ++diff)
+			fn(*diff);
+	}
+
+	const PlaceDiff*				Records() const		{ return m_Records; }
+	const std::vector<uint64_t>&	StepOffsets() const	{ return m_StepOffsets; }
+
+	// heap bytes owned by the index itself, the records stay wherever the archive keeps them
+	uint64_t IndexBytes() const
+	{
+		return m_StepOffsets.capacity() * sizeof(uint64_t);
+	}
+
+	// estimated heap bytes the same data takes as a std::vector<std::vector<PlaceDiff>>
+	// filled one push_back at a time, including growth slack and per-allocation overhead
+	uint64_t NestedLayoutBytes() const
+	{
+		static const uint64_t heap_block_overhead = 16;
+
+		const uint64_t step_count = StepCount();
+		uint64_t bytes = PushBackCapacity(step_count) * sizeof(std::vector<PlaceDiff>) + heap_block_overhead;
+		for (uint64_t step = 0; step < step_count; ++step)
+		{
+			const uint64_t records = m_StepOffsets[step + 1] - m_StepOffsets[step];
+			bytes += PushBackCapacity(records) * sizeof(PlaceDiff) + heap_block_overhead;
+		}
+
+		return bytes;
+	}
+
+private:
+	// capacity std::vector ends up with after count consecutive push_backs
+	static uint64_t PushBackCapacity(uint64_t count)
+	{
+		uint64_t capacity = 0;
+		while (capacity < count)
+		{
+#ifdef _MSC_VER
+			capacity = (capacity / 2 > 0) ? capacity + capacity / 2 : capacity + 1;
+#else
+			capacity = (capacity > 0) ? capacity * 2 : 1;
+#endif
+		}
+
+		return capacity;
+	}
+
+	const PlaceDiff*		m_Records;
+	std::vector<uint64_t>	m_StepOffsets;
+	uint64_t				m_ScannedRecords;	// records Extend() looked at, the open step may still grow past them
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+// an output file stream reused for every frame one thread writes. the stream buffer
+// belongs to the FrameFile and is handed to the stream once, so opening, writing and
+// closing a frame does not allocate the way a fresh std::ofstream per frame does.
+class FrameFile
+{
+public:
+	FrameFile()
+		: m_Buffer(64 * 1024)
+	{
+		m_Stream.rdbuf()->pubsetbuf(m_Buffer.data(), static_cast<std::streamsize>(m_Buffer.size()));
+	}
+
+	FrameFile(const FrameFile&) = delete;
+	FrameFile& operator=(const FrameFile&) = delete;
+
+	// replaces the file at path with data, false if it can't be created or written
+	bool Write(const std::string& path, const char* data, size_t size)
+	{
+		m_Stream.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		m_Stream.write(data, static_cast<std::streamsize>(size));
+		m_Stream.close();
+		const bool written = !m_Stream.fail();
+		m_Stream.clear();
+		return written;
+	}
+
+	bool Write(const std::string& path, const std::vector<char>& data)
+	{
+		return Write(path, data.data(), data.size());
+	}
+
+private:
+	std::vector<char>	m_Buffer;
+	std::ofstream		m_Stream;
+};
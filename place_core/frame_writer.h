@@ -0,0 +1,189 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <inttypes.h>
+
+#include "frame_file.h"
+#include "stage_trace.h"
+
+// an encoded frame waiting to be written, owned by the FrameWriter and reused
+class FrameBuffer
+{
+public:
+	std::string			path;
+	std::vector<char>	data;
+};
+
+class FrameWriterStats
+{
+public:
+	uint64_t	frames = 0;			// frames written
+	uint64_t	bytes = 0;			// bytes written
+	uint64_t	failed = 0;			// frames that could not be created or written
+	double		stall_ms = 0.0;		// time renderers spent waiting for a free buffer
+	double		write_ms = 0.0;		// time writer threads spent creating and writing files, summed
+};
+
+// asynchronous frame output. renderers Acquire() one of a fixed set of buffers, fill it and
+// Submit() it, writer threads drain the queue into files and hand the buffers back. once
+// every buffer is queued or being written Acquire() blocks, which keeps memory bounded to
+// buffer_count frames and lets rendering run ahead of the disk by at most that much.
+// the queue is a ring as large as the buffer set and every writer reuses one FrameFile,
+// so once Reserve() has sized every buffer for the frames and their paths writing them
+// allocates nothing, whichever buffers the writers happen to hand back.
+class FrameWriter
+{
+public:
+	FrameWriter(uint32_t writer_count, uint32_t buffer_count)
+		: m_Buffers(buffer_count > 0 ? buffer_count : 1)
+		, m_Queued(m_Buffers.size(), nullptr)
+		, m_QueueHead(0)
+		, m_QueueCount(0)
+		, m_Closed(false)
+	{
+		m_Free.reserve(m_Buffers.size());
+		for (auto& buffer : m_Buffers)
+			m_Free.push_back(&buffer);
+
+		for (uint32_t i = 0; i < (writer_count > 0 ? writer_count : 1); ++i)
+			m_Writers.emplace_back([this]() { WriterLoop(); });
+	}
+
+	FrameWriter(const FrameWriter&) = delete;
+	FrameWriter& operator=(const FrameWriter&) = delete;
+
+	~FrameWriter()
+	{
+		Close();
+	}
+
+	// grows every buffer to hold frames of frame_bytes with paths of up to path_chars characters.
+	// call it before the first frame, while no buffer is handed out
+	void Reserve(size_t frame_bytes, size_t path_chars)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		for (auto& buffer : m_Buffers)
+		{
+			buffer.data.reserve(frame_bytes);
+			buffer.path.reserve(path_chars);
+		}
+	}
+
+	// blocks until a buffer is free, the caller fills path and data and passes it to Submit()
+	FrameBuffer* Acquire()
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		if (m_Free.empty())
+		{
+			const auto start = std::chrono::steady_clock::now();
+			m_FreeReady.wait(lock, [this]() { return !m_Free.empty(); });
+			m_Stats.stall_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		FrameBuffer* buffer = m_Free.back();
+		m_Free.pop_back();
+		return buffer;
+	}
+
+	void Submit(FrameBuffer* buffer)
+	{
+		{
+			// at most every buffer is queued, the ring never overflows
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Queued[(m_QueueHead + m_QueueCount) % m_Queued.size()] = buffer;
+			++m_QueueCount;
+		}
+		m_QueueReady.notify_one();
+	}
+
+	// copies data into a free buffer and queues it for path
+	void Write(const std::string& path, const std::vector<char>& data)
+	{
+		stage_trace::TraceScope trace("queue", data.size());
+		FrameBuffer* buffer = Acquire();
+		buffer->path = path;
+		buffer->data.assign(data.begin(), data.end());
+		Submit(buffer);
+	}
+
+	// writes everything still queued and stops the writer threads, returns false if any frame failed
+	bool Close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Closed = true;
+		}
+		m_QueueReady.notify_all();
+
+		for (auto& writer : m_Writers)
+			writer.join();
+		m_Writers.clear();
+
+		return m_Stats.failed == 0;
+	}
+
+	// only consistent once Close() has returned
+	const FrameWriterStats& Stats() const
+	{
+		return m_Stats;
+	}
+
+private:
+	void WriterLoop()
+	{
+		FrameFile file;
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		for (;;)
+		{
+			m_QueueReady.wait(lock, [this]() { return m_QueueCount > 0 || m_Closed; });
+			if (m_QueueCount == 0)
+				return;
+
+			FrameBuffer* buffer = m_Queued[m_QueueHead];
+			m_QueueHead = (m_QueueHead + 1) % m_Queued.size();
+			--m_QueueCount;
+			lock.unlock();
+
+			// file creation and the write itself happen outside the lock
+			const auto start = std::chrono::steady_clock::now();
+			bool written = false;
+			{
+				stage_trace::TraceScope trace("write", buffer->data.size());
+				written = file.Write(buffer->path, buffer->data);
+			}
+			const double write_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			lock.lock();
+			m_Stats.write_ms += write_ms;
+			if (written)
+			{
+				++m_Stats.frames;
+				m_Stats.bytes += buffer->data.size();
+			}
+			else
+			{
+				++m_Stats.failed;
+			}
+
+			m_Free.push_back(buffer);
+			m_FreeReady.notify_one();
+		}
+	}
+
+	std::vector<FrameBuffer>	m_Buffers;
+	std::vector<FrameBuffer*>	m_Free;
+	std::vector<FrameBuffer*>	m_Queued;			// ring of m_QueueCount buffers starting at m_QueueHead
+	size_t						m_QueueHead;
+	size_t						m_QueueCount;
+	std::mutex					m_Mutex;
+	std::condition_variable		m_FreeReady;
+	std::condition_variable		m_QueueReady;
+	std::vector<std::thread>	m_Writers;
+	bool						m_Closed;
+	FrameWriterStats			m_Stats;
+};
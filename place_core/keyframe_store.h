@@ -0,0 +1,160 @@
+#pragma once
+
+#include "diff_timeline.h"
+#include "place_canvas.h"
+
+#include <algorithm>
+#include <vector>
+#include <inttypes.h>
+
+class KeyframePolicy
+{
+public:
+	uint64_t	step_interval = 1000;				// take a keyframe at least every N steps
+	uint64_t	pixel_interval = 500000;			// or once M pixels were applied since the last one, 0 disables
+	uint64_t	memory_budget = 64 * 1024 * 1024;	// upper bound for the canvas snapshots, in bytes
+};
+
+template <uint32_t ColorCount>
+class KeyframeT
+{
+public:
+	KeyframeT(uint64_t applied, const PlaceCanvasT<ColorCount>& snapshot)
+		: applied_steps(applied)
+		, canvas(snapshot)
+	{
+	}
+
+	uint64_t	applied_steps;	// number of leading timeline steps baked into the canvas
+	PlaceCanvasT<ColorCount>	canvas;
+};
+
+// canvas snapshots taken at intervals along the timeline so any step can be
+// rebuilt by replaying from the closest snapshot at or before it instead of
+// from the start. when the budget is reached every other keyframe is dropped
+// and the intervals double, keeping the snapshots evenly spread. a store
+// started with Start() takes the keyframes of a growing timeline as Extend()
+// is called, the same ones Build() takes over the finished timeline.
+template <uint32_t ColorCount>
+class KeyframeStoreT
+{
+public:
+	using Keyframe = KeyframeT<ColorCount>;
+
+	KeyframeStoreT()
+		: m_Canvas(0, 0)
+		, m_StepInterval(0)
+		, m_PixelInterval(0)
+		, m_MaxKeyframes(0)
+		, m_BuiltSteps(0)
+		, m_StepsSinceKeyframe(0)
+		, m_PixelsSinceKeyframe(0)
+	{
+	}
+
+	void Build(const DiffTimeline& timeline, int32_t width, int32_t height, const KeyframePolicy& policy = KeyframePolicy())
+	{
+		Start(width, height, policy);
+		Extend(timeline);
+
+		// the timeline is final, the running canvas is not needed anymore
+		m_Canvas = PlaceCanvasT<ColorCount>(0, 0);
+	}
+
+	// an empty store holding only the blank keyframe
+	void Start(int32_t width, int32_t height, const KeyframePolicy& policy = KeyframePolicy())
+	{
+		m_Canvas = PlaceCanvasT<ColorCount>(width, height);
+		const uint64_t keyframe_bytes = m_Canvas.SizeBytes() + sizeof(Keyframe);
+
+		m_StepInterval = (std::max)(policy.step_interval, static_cast<uint64_t>(1));
+		m_PixelInterval = policy.pixel_interval;
+		m_MaxKeyframes = static_cast<size_t>((std::max)(policy.memory_budget / keyframe_bytes, static_cast<uint64_t>(2)));
+
+		m_Keyframes.clear();
+		m_Keyframes.reserve(m_MaxKeyframes);
+		m_Keyframes.emplace_back(0, m_Canvas);
+
+		m_BuiltSteps = 0;
+		m_StepsSinceKeyframe = 0;
+		m_PixelsSinceKeyframe = 0;
+	}
+
+	// applies the steps added to the timeline since the last call, taking keyframes along the way
+	void Extend(const DiffTimeline& timeline)
+	{
+		stage_trace::TraceScope trace("keyframes", timeline.StepCount() - m_BuiltSteps);
+		for (; m_BuiltSteps < timeline.StepCount(); ++m_BuiltSteps)
+		{
+			const DiffStep diff_step = timeline.Step(m_BuiltSteps);
+			m_Canvas.Apply(diff_step);
+
+			++m_StepsSinceKeyframe;
+			m_PixelsSinceKeyframe += diff_step.size();
+			if (m_StepsSinceKeyframe >= m_StepInterval || (m_PixelInterval > 0 && m_PixelsSinceKeyframe >= m_PixelInterval))
+			{
+				if (m_Keyframes.size() >= m_MaxKeyframes)
+					Thin();
+
+				m_Keyframes.emplace_back(m_BuiltSteps + 1, m_Canvas);
+				m_StepsSinceKeyframe = 0;
+				m_PixelsSinceKeyframe = 0;
+			}
+		}
+	}
+
+	// the closest keyframe with applied_steps at or before the requested step count
+	const Keyframe& Nearest(uint64_t applied_steps) const
+	{
+		auto next = std::upper_bound(m_Keyframes.begin(), m_Keyframes.end(), applied_steps,
+			[](uint64_t steps, const Keyframe& keyframe) { return steps < keyframe.applied_steps; });
+		return *(next - 1);
+	}
+
+	// rebuilds the canvas as it was after the first applied_steps steps
+	void Restore(uint64_t applied_steps, const DiffTimeline& timeline, PlaceCanvasT<ColorCount>& canvas) const
+	{
+		const Keyframe& keyframe = Nearest(applied_steps);
+		canvas = keyframe.canvas;
+		for (uint64_t step = keyframe.applied_steps; step < applied_steps; ++step)
+			canvas.Apply(timeline.Step(step));
+	}
+
+	uint64_t MemoryBytes() const
+	{
+		uint64_t bytes = m_Keyframes.capacity() * sizeof(Keyframe) + m_Canvas.SizeBytes();
+		for (const auto& keyframe : m_Keyframes)
+			bytes += keyframe.canvas.SizeBytes();
+		return bytes;
+	}
+
+	bool		Empty() const			{ return m_Keyframes.empty(); }
+	size_t		Count() const			{ return m_Keyframes.size(); }
+	uint64_t	StepInterval() const	{ return m_StepInterval; }
+	uint64_t	PixelInterval() const	{ return m_PixelInterval; }
+
+private:
+	// drops every other keyframe (never the first) and doubles the spacing
+	void Thin()
+	{
+		size_t kept = 1;
+		for (size_t i = 2; i < m_Keyframes.size(); i += 2)
+			m_Keyframes[kept++] = std::move(m_Keyframes[i]);
+		m_Keyframes.erase(m_Keyframes.begin() + kept, m_Keyframes.end());
+
+		m_StepInterval *= 2;
+		m_PixelInterval *= 2;
+	}
+
+	std::vector<Keyframe>	m_Keyframes;
+	PlaceCanvasT<ColorCount>	m_Canvas;		// the canvas after m_BuiltSteps steps
+	uint64_t				m_StepInterval;
+	uint64_t				m_PixelInterval;
+	size_t					m_MaxKeyframes;
+	uint64_t				m_BuiltSteps;
+	uint64_t				m_StepsSinceKeyframe;
+	uint64_t				m_PixelsSinceKeyframe;
+};
+
+using Keyframe = KeyframeT<16>;
+using KeyframeStore = KeyframeStoreT<16>;
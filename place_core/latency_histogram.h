@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+// collects latency samples (in milliseconds) and reports them as a
+// power-of-two microsecond histogram plus exact percentiles
+class LatencyHistogram
+{
+public:
+	void Record(double ms)
+	{
+		m_Samples.push_back(ms);
+	}
+
+	void Clear()
+	{
+		m_Samples.clear();
+	}
+
+	size_t Count() const
+	{
+		return m_Samples.size();
+	}
+
+	// nearest-rank percentile, p in [0, 100]
+	double Percentile(double p) const
+	{
+		if (m_Samples.empty())
+			return 0.0;
+
+		std::vector<double> sorted(m_Samples);
+		std::sort(sorted.begin(), sorted.end());
+		size_t rank = static_cast<size_t>((p / 100.0) * static_cast<double>(sorted.size()));
+		if (rank >= sorted.size())
+			rank = sorted.size() - 1;
+		return sorted[rank];
+	}
+
+	double Mean() const
+	{
+		double total = 0.0;
+		for (const double sample : m_Samples)
+			total += sample;
+		return m_Samples.empty() ? 0.0 : total / static_cast<double>(m_Samples.size());
+	}
+
+	void Print(std::ostream& out, const std::string& label) const
+	{
+		out << label << ": " << m_Samples.size() << " samples, mean " << Mean()
+			<< " ms, p50 " << Percentile(50.0) << " ms, p99 " << Percentile(99.0)
+			<< " ms, max " << Percentile(100.0) << " ms" << std::endl;
+
+		// bucket b holds samples in [2^(b-1), 2^b) microseconds, bucket 0 everything below 1us
+		std::vector<size_t> buckets;
+		for (const double sample : m_Samples)
+		{
+			size_t bucket = 0;
+			for (double us = sample * 1000.0; us >= 1.0; us /= 2.0)
+				++bucket;
+			if (bucket >= buckets.size())
+				buckets.resize(bucket + 1, 0);
+			++buckets[bucket];
+		}
+
+		const size_t peak = buckets.empty() ? 0 : *std::max_element(buckets.begin(), buckets.end());
+		size_t first = 0;
+		while (first < buckets.size() && buckets[first] == 0)
+			++first;
+
+		for (size_t bucket = first; bucket < buckets.size(); ++bucket)
+		{
+			const uint64_t upper_us = 1ull << bucket;
+			const size_t bar = peak > 0 ? (buckets[bucket] * 50 + peak - 1) / peak : 0;
+			out << "  < " << upper_us << " us\t" << buckets[bucket] << "\t" << std::string(bar, '#') << std::endl;
+		}
+	}
+
+private:
+	std::vector<double>	m_Samples;
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "bmp_expand.h"
+#include "bmp_format.h"
+#include "place_canvas.h"
+
+#include <algorithm>
+#include <vector>
+#include <inttypes.h>
+
+// downscaled copies of the canvas at 1/2, 1/4 and 1/8, each an encoded 24 bit .bmp.
+// every level keeps the per channel color sum of the canvas pixels under each of its
+// cells, so a changed pixel adds its color delta to one cell per level and re-encodes
+// just those cells, the rest of the pyramid is never touched.
+template <uint32_t ColorCount>
+class MipPyramidT
+{
+public:
+	static const uint32_t level_count = 4;		// level 0 is the canvas itself and not stored here
+
+	MipPyramidT(int32_t width, int32_t height, const BmpExpandTablesT<ColorCount>& palette)
+		: m_Width(width)
+		, m_Height(height)
+		, m_Palette(palette)
+	{
+		for (uint32_t level = 1; level < level_count; ++level)
+		{
+			Level& mip = m_Levels[level];
+			mip.width = (width + (1 << level) - 1) >> level;
+			mip.height = (height + (1 << level) - 1) >> level;
+			mip.sums.assign(static_cast<size_t>(mip.width) * mip.height * 3, 0);
+			mip.stride = InitBitMapBuffer(mip.width, mip.height, mip.encoded);
+			mip.pixel_offset = mip.encoded.size() - mip.stride * mip.height;
+		}
+	}
+
+	// rebuilds every level from scratch, level 1 from the canvas and each further level from the one below
+	void Reset(const PlaceCanvasT<ColorCount>& canvas)
+	{
+		Level& half = m_Levels[1];
+		std::fill(half.sums.begin(), half.sums.end(), static_cast<uint16_t>(0));
+		for (int32_t y = 0; y < m_Height; ++y)
+		{
+			for (int32_t x = 0; x < m_Width; ++x)
+			{
+				const uint8_t index = canvas.Get(x, y);
+				uint16_t* sum = half.sums.data() + (static_cast<size_t>(y >> 1) * half.width + (x >> 1)) * 3;
+				sum[0] = static_cast<uint16_t>(sum[0] + m_Palette.byte0[index]);
+				sum[1] = static_cast<uint16_t>(sum[1] + m_Palette.byte1[index]);
+				sum[2] = static_cast<uint16_t>(sum[2] + m_Palette.byte2[index]);
+			}
+		}
+
+		for (uint32_t level = 2; level < level_count; ++level)
+		{
+			const Level& child = m_Levels[level - 1];
+			Level& mip = m_Levels[level];
+			std::fill(mip.sums.begin(), mip.sums.end(), static_cast<uint16_t>(0));
+			for (int32_t y = 0; y < child.height; ++y)
+			{
+				for (int32_t x = 0; x < child.width; ++x)
+				{
+					const uint16_t* child_sum = child.sums.data() + (static_cast<size_t>(y) * child.width + x) * 3;
+					uint16_t* sum = mip.sums.data() + (static_cast<size_t>(y >> 1) * mip.width + (x >> 1)) * 3;
+					for (int channel = 0; channel < 3; ++channel)
+						sum[channel] = static_cast<uint16_t>(sum[channel] + child_sum[channel]);
+				}
+			}
+		}
+
+		for (uint32_t level = 1; level < level_count; ++level)
+		{
+			Level& mip = m_Levels[level];
+			for (int32_t y = 0; y < mip.height; ++y)
+				for (int32_t x = 0; x < mip.width; ++x)
+					EncodeCell(level, x, y);
+		}
+	}
+
+	// a canvas pixel changed from old_index to new_index
+	void Update(uint32_t x, uint32_t y, uint8_t old_index, uint8_t new_index)
+	{
+		if (old_index == new_index)
+			return;
+
+		const int delta[3] =
+		{
+			m_Palette.byte0[new_index] - m_Palette.byte0[old_index],
+			m_Palette.byte1[new_index] - m_Palette.byte1[old_index],
+			m_Palette.byte2[new_index] - m_Palette.byte2[old_index],
+		};
+
+		for (uint32_t level = 1; level < level_count; ++level)
+		{
+			const int32_t cell_x = static_cast<int32_t>(x >> level);
+			const int32_t cell_y = static_cast<int32_t>(y >> level);
+			Level& mip = m_Levels[level];
+			uint16_t* sum = mip.sums.data() + (static_cast<size_t>(cell_y) * mip.width + cell_x) * 3;
+			for (int channel = 0; channel < 3; ++channel)
+				sum[channel] = static_cast<uint16_t>(sum[channel] + delta[channel]);
+			EncodeCell(level, cell_x, cell_y);
+		}
+	}
+
+	// the encoded .bmp of a level in [1, level_count)
+	const std::vector<char>& Encoded(uint32_t level) const	{ return m_Levels[level].encoded; }
+	int32_t Width(uint32_t level) const						{ return m_Levels[level].width; }
+	int32_t Height(uint32_t level) const					{ return m_Levels[level].height; }
+
+private:
+	class Level
+	{
+	public:
+		int32_t					width = 0;
+		int32_t					height = 0;
+		std::vector<uint16_t>	sums;			// blue, green, red sum per cell, at most 64 * 255
+		std::vector<char>		encoded;
+		size_t					stride = 0;
+		size_t					pixel_offset = 0;
+	};
+
+	// writes the average color of one cell, edge cells cover fewer canvas pixels
+	void EncodeCell(uint32_t level, int32_t cell_x, int32_t cell_y)
+	{
+		Level& mip = m_Levels[level];
+		const int32_t scale = 1 << level;
+		const int32_t covered_x = (std::min)(scale, m_Width - cell_x * scale);
+		const int32_t covered_y = (std::min)(scale, m_Height - cell_y * scale);
+		const uint32_t pixels = static_cast<uint32_t>(covered_x * covered_y);
+
+		const uint16_t* sum = mip.sums.data() + (static_cast<size_t>(cell_y) * mip.width + cell_x) * 3;
+		char* dest = mip.encoded.data() + mip.pixel_offset + static_cast<size_t>(mip.height - 1 - cell_y) * mip.stride + cell_x * 3;
+		for (int channel = 0; channel < 3; ++channel)
+			dest[channel] = static_cast<char>((sum[channel] + pixels / 2) / pixels);
+	}
+
+	int32_t							m_Width;
+	int32_t							m_Height;
+	BmpExpandTablesT<ColorCount>	m_Palette;
+	Level							m_Levels[level_count];
+};
+
+using MipPyramid = MipPyramidT<16>;
@@ -0,0 +1,376 @@
+#pragma once
+
+#include "parallel.h"
+#include "place_diff.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+// packed diff archive (.plz)
+//
+//   PackedArchiveHeader
+//   block 0 .. block n-1, each:
+//     PackedBlockHeader
+//     timestamp stream: zigzag LEB128 delta of every record's timestamp to the previous one
+//     pixel stream: x, y (coord_bits each) and color (color_bits) per record, packed LSB first
+//   block index: uint64 file offset of every block
+//
+// every block but the last holds records_per_block records and decodes on its own,
+// so blocks can be decoded in any order and in parallel. the 2017 archive packs
+// 16 byte records into roughly 4.
+
+class PackedArchiveHeader
+{
+public:
+	char		magic[4];			// "PLZ1"
+	uint32_t	version;
+	uint32_t	width;				// canvas width in pixels
+	uint32_t	height;				// canvas height in pixels
+	uint32_t	records_per_block;
+	uint8_t		coord_bits;			// bits per x and per y coordinate
+	uint8_t		color_bits;			// bits per color index
+	uint16_t	reserved;
+	uint64_t	record_count;
+	uint64_t	block_count;
+	uint64_t	index_offset;		// file offset of the block index
+};
+
+class PackedBlockHeader
+{
+public:
+	uint32_t	record_count;
+	uint32_t	first_timestamp;
+	uint32_t	timestamp_bytes;	// size of the timestamp stream
+	uint32_t	pixel_bytes;		// size of the pixel stream
+};
+
+static_assert(sizeof(PackedArchiveHeader) == 48, "PackedArchiveHeader is written to disk as is");
+static_assert(sizeof(PackedBlockHeader) == 16, "PackedBlockHeader is written to disk as is");
+
+namespace packed_archive
+{
+	static const char magic[4] = { 'P', 'L', 'Z', '1' };
+	static const uint32_t version = 1;
+	static const uint32_t default_records_per_block = 64 * 1024;
+
+	inline bool IsPacked(const uint8_t* data, uint64_t size)
+	{
+		return size >= sizeof(PackedArchiveHeader) && std::memcmp(data, magic, sizeof(magic)) == 0;
+	}
+
+	// smallest number of bits that can hold value
+	inline uint8_t BitsFor(uint32_t value)
+	{
+		uint8_t bits = 1;
+		while (bits < 32 && (value >> bits) != 0)
+			++bits;
+		return bits;
+	}
+
+	template <typename T>
+	T Read(const uint8_t* data)
+	{
+		T value;
+		std::memcpy(&value, data, sizeof(T));
+		return value;
+	}
+}
+
+// streaming encoder, holds one block of records in memory at a time
+class PackedArchiveWriter
+{
+public:
+	PackedArchiveWriter()
+		: m_Header()
+		, m_BytesWritten(0)
+	{
+	}
+
+	// coord_bits and color_bits must be wide enough for every record that is appended
+	bool Open(const std::string& path, uint32_t width, uint32_t height, uint8_t coord_bits, uint8_t color_bits,
+		uint32_t records_per_block = packed_archive::default_records_per_block)
+	{
+		m_File.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!m_File.is_open())
+			return false;
+
+		std::memcpy(m_Header.magic, packed_archive::magic, sizeof(m_Header.magic));
+		m_Header.version = packed_archive::version;
+		m_Header.width = width;
+		m_Header.height = height;
+		m_Header.records_per_block = records_per_block;
+		m_Header.coord_bits = coord_bits;
+		m_Header.color_bits = color_bits;
+		m_Header.reserved = 0;
+		m_Header.record_count = 0;
+		m_Header.block_count = 0;
+		m_Header.index_offset = 0;
+
+		// written again with the final counts by Close()
+		m_File.write(reinterpret_cast<const char*>(&m_Header), sizeof(m_Header));
+		m_Pending.reserve(records_per_block);
+		m_BlockOffsets.clear();
+		return m_File.good();
+	}
+
+	void Append(const PlaceDiff& diff)
+	{
+		m_Pending.push_back(diff);
+		if (m_Pending.size() == m_Header.records_per_block)
+			FlushBlock();
+	}
+
+	bool Close()
+	{
+		FlushBlock();
+
+		m_Header.block_count = m_BlockOffsets.size();
+		m_Header.index_offset = static_cast<uint64_t>(m_File.tellp());
+		m_File.write(reinterpret_cast<const char*>(m_BlockOffsets.data()), m_BlockOffsets.size() * sizeof(uint64_t));
+		m_BytesWritten = static_cast<uint64_t>(m_File.tellp());
+
+		m_File.seekp(0, std::ios::beg);
+		m_File.write(reinterpret_cast<const char*>(&m_Header), sizeof(m_Header));
+		const bool written = m_File.good();
+		m_File.close();
+		return written;
+	}
+
+	// size of the finished archive, valid after Close()
+	uint64_t BytesWritten() const
+	{
+		return m_BytesWritten;
+	}
+
+private:
+	void FlushBlock()
+	{
+		if (m_Pending.empty())
+			return;
+
+		m_Timestamps.clear();
+		m_Pixels.clear();
+
+		uint32_t previous = m_Pending.front().timestamp;
+		uint64_t bits = 0;
+		uint32_t bit_count = 0;
+		for (const auto& diff : m_Pending)
+		{
+			// zigzag so that out of order timestamps still encode
+			const int64_t delta = static_cast<int64_t>(diff.timestamp) - static_cast<int64_t>(previous);
+			uint64_t zigzag = (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63);
+			do
+			{
+				const uint8_t byte = static_cast<uint8_t>(zigzag & 0x7F);
+				zigzag >>= 7;
+				m_Timestamps.push_back(zigzag != 0 ? (byte | 0x80) : byte);
+			} while (zigzag != 0);
+			previous = diff.timestamp;
+
+			PutBits(diff.x, m_Header.coord_bits, bits, bit_count);
+			PutBits(diff.y, m_Header.coord_bits, bits, bit_count);
+			PutBits(static_cast<uint32_t>(diff.color), m_Header.color_bits, bits, bit_count);
+		}
+
+		if (bit_count > 0)
+			m_Pixels.push_back(static_cast<uint8_t>(bits));
+
+		PackedBlockHeader block;
+		block.record_count = static_cast<uint32_t>(m_Pending.size());
+		block.first_timestamp = m_Pending.front().timestamp;
+		block.timestamp_bytes = static_cast<uint32_t>(m_Timestamps.size());
+		block.pixel_bytes = static_cast<uint32_t>(m_Pixels.size());
+
+		m_BlockOffsets.push_back(static_cast<uint64_t>(m_File.tellp()));
+		m_File.write(reinterpret_cast<const char*>(&block), sizeof(block));
+		m_File.write(reinterpret_cast<const char*>(m_Timestamps.data()), m_Timestamps.size());
+		m_File.write(reinterpret_cast<const char*>(m_Pixels.data()), m_Pixels.size());
+
+		m_Header.record_count += m_Pending.size();
+		m_Pending.clear();
+	}
+
+	void PutBits(uint32_t value, uint32_t width, uint64_t& bits, uint32_t& bit_count)
+	{
+		bits |= static_cast<uint64_t>(value) << bit_count;
+		bit_count += width;
+		while (bit_count >= 8)
+		{
+			m_Pixels.push_back(static_cast<uint8_t>(bits));
+			bits >>= 8;
+			bit_count -= 8;
+		}
+	}
+
+	std::ofstream			m_File;
+	PackedArchiveHeader		m_Header;
+	std::vector<PlaceDiff>	m_Pending;
+	std::vector<uint8_t>	m_Timestamps;
+	std::vector<uint8_t>	m_Pixels;
+	std::vector<uint64_t>	m_BlockOffsets;
+	uint64_t				m_BytesWritten;
+};
+
+// decoder over a packed archive that is already in memory (usually a MappedFile)
+class PackedArchiveView
+{
+public:
+	PackedArchiveView()
+		: m_Data(nullptr)
+		, m_Size(0)
+		, m_Header()
+	{
+	}
+
+	// false unless the header, the block index and every block header are consistent with each
+	// other and with size, so decoding never reads past the data or writes past a block's records
+	bool Open(const uint8_t* data, uint64_t size)
+	{
+		if (!packed_archive::IsPacked(data, size))
+			return false;
+
+		m_Header = packed_archive::Read<PackedArchiveHeader>(data);
+		if (m_Header.version != packed_archive::version || m_Header.coord_bits > 32 || m_Header.color_bits > 32 || m_Header.records_per_block == 0)
+			return false;
+		if (m_Header.index_offset < sizeof(PackedArchiveHeader) || m_Header.index_offset > size
+			|| m_Header.block_count > (size - m_Header.index_offset) / sizeof(uint64_t))
+			return false;
+		if (m_Header.block_count != (m_Header.record_count + m_Header.records_per_block - 1) / m_Header.records_per_block)
+			return false;
+
+		m_Data = data;
+		m_Size = size;
+		if (!CheckBlocks())
+		{
+			*this = PackedArchiveView();
+			return false;
+		}
+		return true;
+	}
+
+	uint64_t BlockOffset(uint64_t block) const
+	{
+		return packed_archive::Read<uint64_t>(m_Data + m_Header.index_offset + block * sizeof(uint64_t));
+	}
+
+	// index of the first record of a block in the decoded record array
+	uint64_t BlockFirstRecord(uint64_t block) const
+	{
+		return block * m_Header.records_per_block;
+	}
+
+	// records_per_block for every block but the last, which holds the rest
+	uint32_t BlockRecordCount(uint64_t block) const
+	{
+		return static_cast<uint32_t>((std::min)(static_cast<uint64_t>(m_Header.records_per_block), m_Header.record_count - BlockFirstRecord(block)));
+	}
+
+	// decodes one block into out, which must have room for BlockRecordCount(block) records
+	uint32_t DecodeBlock(uint64_t block, PlaceDiff* out) const
+	{
+		const uint8_t* block_data = m_Data + BlockOffset(block);
+		const PackedBlockHeader header = packed_archive::Read<PackedBlockHeader>(block_data);
+		const uint8_t* timestamps = block_data + sizeof(PackedBlockHeader);
+		const uint8_t* timestamps_end = timestamps + header.timestamp_bytes;
+		const uint8_t* pixels = timestamps_end;
+		const uint8_t* pixels_end = pixels + header.pixel_bytes;
+
+		const uint32_t coord_bits = m_Header.coord_bits;
+		const uint32_t color_bits = m_Header.color_bits;
+		uint32_t timestamp = header.first_timestamp;
+		uint64_t bits = 0;
+		uint32_t bit_count = 0;
+		for (uint32_t i = 0; i < header.record_count; ++i)
+		{
+			uint64_t zigzag = 0;
+			for (uint32_t shift = 0; ; shift += 7)
+			{
+				// a damaged stream ends the value instead of reading on into the next one
+				const uint8_t byte = (timestamps < timestamps_end) ? *timestamps++ : 0;
+				if (shift < 64)
+					zigzag |= static_cast<uint64_t>(byte & 0x7F) << shift;
+				if ((byte & 0x80) == 0)
+					break;
+			}
+			const int64_t delta = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+			timestamp = static_cast<uint32_t>(static_cast<int64_t>(timestamp) + delta);
+
+			PlaceDiff& diff = out[i];
+			diff.timestamp = timestamp;
+			diff.x = TakeBits(coord_bits, bits, bit_count, pixels, pixels_end);
+			diff.y = TakeBits(coord_bits, bits, bit_count, pixels, pixels_end);
+			diff.color = static_cast<DiffColor>(TakeBits(color_bits, bits, bit_count, pixels, pixels_end));
+		}
+
+		return header.record_count;
+	}
+
+	// decodes every block into records, which is resized to fit, on up to thread_count threads
+	void DecodeAll(std::vector<PlaceDiff>& records, uint32_t thread_count = 0) const
+	{
+		records.resize(static_cast<size_t>(m_Header.record_count));
+
+		const uint64_t block_count = m_Header.block_count;
+		const uint32_t workers = static_cast<uint32_t>((std::min)(static_cast<uint64_t>(thread_count > 0 ? thread_count : DefaultThreadCount()), (std::max)(block_count, static_cast<uint64_t>(1))));
+		PlaceDiff* out = records.data();
+		RunParallel(workers, [this, out, block_count, workers](uint32_t worker)
+		{
+			uint64_t first_block = 0;
+			uint64_t last_block = 0;
+			SplitRange(block_count, workers, worker, first_block, last_block);
+			for (uint64_t block = first_block; block < last_block; ++block)
+				DecodeBlock(block, out + BlockFirstRecord(block));
+		});
+	}
+
+	const PackedArchiveHeader& Header() const
+	{
+		return m_Header;
+	}
+
+private:
+	// every block lies between the header and the index, holds the records its place in the
+	// archive calls for and is large enough for them: at least one timestamp byte and all the
+	// pixel bits per record, as the writer encodes them
+	bool CheckBlocks() const
+	{
+		const uint64_t record_bits = 2 * static_cast<uint64_t>(m_Header.coord_bits) + m_Header.color_bits;
+		for (uint64_t block = 0; block < m_Header.block_count; ++block)
+		{
+			const uint64_t offset = BlockOffset(block);
+			if (offset < sizeof(PackedArchiveHeader) || offset > m_Header.index_offset || m_Header.index_offset - offset < sizeof(PackedBlockHeader))
+				return false;
+
+			const PackedBlockHeader header = packed_archive::Read<PackedBlockHeader>(m_Data + offset);
+			const uint64_t stream_bytes = static_cast<uint64_t>(header.timestamp_bytes) + header.pixel_bytes;
+			if (header.record_count != BlockRecordCount(block) || stream_bytes > m_Header.index_offset - offset - sizeof(PackedBlockHeader))
+				return false;
+			if (header.timestamp_bytes < header.record_count || header.pixel_bytes < (header.record_count * record_bits + 7) / 8)
+				return false;
+		}
+		return true;
+	}
+
+	static uint32_t TakeBits(uint32_t width, uint64_t& bits, uint32_t& bit_count, const uint8_t*& data, const uint8_t* data_end)
+	{
+		while (bit_count < width)
+		{
+			const uint64_t byte = (data < data_end) ? *data++ : 0;
+			bits |= byte << bit_count;
+			bit_count += 8;
+		}
+
+		const uint32_t value = static_cast<uint32_t>(bits & ((1ull << width) - 1));
+		bits >>= width;
+		bit_count -= width;
+		return value;
+	}
+
+	const uint8_t*			m_Data;
+	uint64_t				m_Size;
+	PackedArchiveHeader		m_Header;
+};
@@ -0,0 +1,395 @@
+#pragma once
+
+#include "diff_archive.h"
+#include "diff_timeline.h"
+#include "place_canvas.h"
+#include "stage_trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+class PagedTimelinePolicy
+{
+public:
+	uint64_t	memory_budget = 256 * 1024 * 1024;	// step index, block cache and keyframes together, in bytes
+	uint64_t	block_records = 64 * 1024;			// records read from disk at a time
+	uint64_t	keyframe_steps = 1000;				// keyframes are taken every N steps
+	uint32_t	cache_percent = 25;					// part of the budget left after the index that caches blocks
+};
+
+class PagedTimelineStats
+{
+public:
+	double		scan_ms = 0.0;			// the one pass over the file that validates and indexes it
+	uint64_t	index_bytes = 0;		// step index, block table and step buffer, resident for good
+	uint64_t	cache_blocks = 0;		// blocks the cache holds at most
+	uint64_t	keyframe_slots = 0;		// keyframes the budget holds at most
+	uint64_t	block_reads = 0;		// blocks read from disk after the scan
+	uint64_t	block_hits = 0;			// block lookups the cache answered
+	uint64_t	bytes_read = 0;			// bytes read from disk after the scan
+	uint64_t	restores = 0;			// Restore() calls
+	uint64_t	keyframe_hits = 0;		// restores whose own keyframe was resident
+	uint64_t	keyframes_built = 0;	// keyframes rebuilt by replaying steps
+	uint64_t	keyframes_evicted = 0;
+};
+
+// a timeline over a raw archive that stays on disk, for archives larger than memory. one pass over
+// the file validates the records and indexes the steps by their position among the records kept.
+// after that the records are read a block at a time into a small cache, and the only canvases kept
+// are keyframes, rebuilt on demand by replaying from the closest one before them. blocks and
+// keyframes are evicted least recently used first, so the index, the cache and the keyframes stay
+// within the budget whatever the size of the file. packed archives are decoded whole instead.
+template <uint32_t ColorCount>
+class PagedTimelineT
+{
+public:
+	PagedTimelineT()
+		: m_Width(0)
+		, m_Height(0)
+		, m_ColorCount(0)
+		, m_FileRecords(0)
+		, m_BlockRecords(0)
+		, m_KeyframeSteps(1)
+		, m_CacheBlocks(0)
+		, m_MaxKeyframes(0)
+		, m_Tick(0)
+		, m_Failed(false)
+	{
+	}
+
+	PagedTimelineT(const PagedTimelineT&) = delete;
+	PagedTimelineT& operator=(const PagedTimelineT&) = delete;
+
+	// validates and indexes the archive against a width x height canvas with color_count colors.
+	// false if the file can't be read or is a packed archive
+	bool Open(const std::string& path, int32_t width, int32_t height, uint32_t color_count, const PagedTimelinePolicy& policy = PagedTimelinePolicy())
+	{
+		Close();
+
+		stage_trace::TraceScope trace("scan");
+		const auto start = std::chrono::steady_clock::now();
+		m_File.open(path, std::ios::in | std::ios::binary);
+		if (!m_File.is_open())
+			return false;
+
+		m_File.seekg(0, std::ios::end);
+		const uint64_t file_bytes = static_cast<uint64_t>(m_File.tellg());
+		char magic[sizeof(packed_archive::magic)] = {};
+		m_File.seekg(0, std::ios::beg);
+		m_File.read(magic, sizeof(magic));
+		if (file_bytes >= sizeof(PackedArchiveHeader) && std::memcmp(magic, packed_archive::magic, sizeof(magic)) == 0)
+		{
+			Close();
+			return false;
+		}
+
+		m_Width = static_cast<uint32_t>((std::max)(width, 0));
+		m_Height = static_cast<uint32_t>((std::max)(height, 0));
+		m_ColorCount = color_count;
+		m_FileRecords = file_bytes / sizeof(PlaceDiff);
+		m_BlockRecords = (std::max)(policy.block_records, static_cast<uint64_t>(1));
+		m_KeyframeSteps = (std::max)(policy.keyframe_steps, static_cast<uint64_t>(1));
+		const uint64_t block_count = (m_FileRecords + m_BlockRecords - 1) / m_BlockRecords;
+
+		// a step starts at every kept record whose timestamp differs from the kept record before it
+		std::vector<PlaceDiff> block(static_cast<size_t>(m_BlockRecords));
+		m_BlockStarts.reserve(static_cast<size_t>(block_count + 1));
+		uint64_t kept_records = 0;
+		uint32_t timestamp = 0;
+		for (uint64_t block_index = 0; block_index < block_count; ++block_index)
+		{
+			m_BlockStarts.push_back(kept_records);
+			const uint64_t count = ReadBlock(block_index, block.data());
+			if (count == 0)
+			{
+				Close();
+				return false;
+			}
+
+			const uint64_t kept = SanitizeRecords(block.data(), count, m_Width, m_Height, m_ColorCount, m_Report);
+			for (uint64_t record = 0; record < kept; ++record)
+			{
+				if (m_StepOffsets.empty() || block[record].timestamp != timestamp)
+				{
+					m_StepOffsets.push_back(kept_records + record);
+					timestamp = block[record].timestamp;
+				}
+			}
+			kept_records += kept;
+		}
+		m_BlockStarts.push_back(kept_records);
+		m_StepOffsets.push_back(kept_records);
+		m_StepOffsets.shrink_to_fit();
+
+		uint64_t max_step_records = 0;
+		for (size_t step = 0; step + 1 < m_StepOffsets.size(); ++step)
+			max_step_records = (std::max)(max_step_records, m_StepOffsets[step + 1] - m_StepOffsets[step]);
+		m_StepBuffer.reserve(static_cast<size_t>(max_step_records));
+
+		// the index is fixed by the archive, the rest of the budget is split between blocks and keyframes
+		const uint64_t keyframe_count = StepCount() / m_KeyframeSteps + 1;
+		m_BlockSlot.assign(static_cast<size_t>(block_count), no_slot);
+		m_KeyframeSlot.assign(static_cast<size_t>(keyframe_count), no_slot);
+		m_Stats.index_bytes = (m_StepOffsets.size() + m_BlockStarts.size()) * sizeof(uint64_t) + (block_count + keyframe_count) * sizeof(uint32_t)
+			+ max_step_records * sizeof(PlaceDiff);
+
+		const uint64_t block_bytes = m_BlockRecords * sizeof(PlaceDiff);
+		const uint64_t keyframe_bytes = PlaceCanvasT<ColorCount>(width, 1).SizeBytes() * m_Height;
+		const uint64_t left = (policy.memory_budget > m_Stats.index_bytes) ? policy.memory_budget - m_Stats.index_bytes : 0;
+		m_CacheBlocks = (std::min)((std::max)(left * policy.cache_percent / 100 / block_bytes, static_cast<uint64_t>(2)), (std::max)(block_count, static_cast<uint64_t>(1)));
+		const uint64_t cache_bytes = m_CacheBlocks * block_bytes;
+		m_MaxKeyframes = (left > cache_bytes && keyframe_bytes > 0) ? (std::min)((left - cache_bytes) / keyframe_bytes, keyframe_count) : 0;
+		m_Blocks.reserve(static_cast<size_t>(m_CacheBlocks));
+		m_Keyframes.reserve(static_cast<size_t>(m_MaxKeyframes));
+
+		m_Stats.cache_blocks = m_CacheBlocks;
+		m_Stats.keyframe_slots = m_MaxKeyframes;
+		m_Stats.scan_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		trace.SetItems(m_FileRecords);
+		return true;
+	}
+
+	void Close()
+	{
+		m_File.close();
+		m_File.clear();
+		m_StepOffsets.clear();
+		m_BlockStarts.clear();
+		m_BlockSlot.clear();
+		m_KeyframeSlot.clear();
+		m_Blocks.clear();
+		m_Keyframes.clear();
+		m_StepBuffer.clear();
+		m_FileRecords = 0;
+		m_CacheBlocks = 0;
+		m_MaxKeyframes = 0;
+		m_Tick = 0;
+		m_Failed = false;
+		m_Report = DiffValidationReport();
+		m_Stats = PagedTimelineStats();
+	}
+
+	// the records of one step, read in if they aren't cached. valid until the next call,
+	// empty if the file could not be read
+	DiffStep Step(uint64_t step)
+	{
+		const uint64_t first = m_StepOffsets[step];
+		const uint64_t last = m_StepOffsets[step + 1];
+		uint64_t block = static_cast<uint64_t>(std::upper_bound(m_BlockStarts.begin(), m_BlockStarts.end(), first) - m_BlockStarts.begin()) - 1;
+		const PlaceDiff* records = Block(block);
+		if (records == nullptr)
+			return DiffStep();
+		if (last <= m_BlockStarts[block + 1])
+			return DiffStep(records + (first - m_BlockStarts[block]), records + (last - m_BlockStarts[block]));
+
+		// a step spanning blocks is gathered into the step buffer
+		m_StepBuffer.clear();
+		for (uint64_t record = first; record < last; ++block)
+		{
+			records = Block(block);
+			if (records == nullptr)
+				return DiffStep();
+			const uint64_t block_end = (std::min)(last, m_BlockStarts[block + 1]);
+			m_StepBuffer.insert(m_StepBuffer.end(), records + (record - m_BlockStarts[block]), records + (block_end - m_BlockStarts[block]));
+			record = block_end;
+		}
+		return DiffStep(m_StepBuffer.data(), m_StepBuffer.data() + m_StepBuffer.size());
+	}
+
+	// rebuilds the canvas as it was after the first applied_steps steps from the closest resident
+	// keyframe at or before it, keeping every keyframe passed on the way. false if a read failed
+	bool Restore(uint64_t applied_steps, PlaceCanvasT<ColorCount>& canvas)
+	{
+		applied_steps = (std::min)(applied_steps, StepCount());
+		const uint64_t target = applied_steps / m_KeyframeSteps;
+		uint64_t keyframe = target;
+		while (keyframe > 0 && m_KeyframeSlot[keyframe] == no_slot)
+			--keyframe;
+
+		++m_Stats.restores;
+		if (keyframe > 0)
+		{
+			KeyframeSlot& slot = m_Keyframes[m_KeyframeSlot[keyframe]];
+			slot.last_use = ++m_Tick;
+			canvas = slot.canvas;
+			m_Stats.keyframe_hits += (keyframe == target) ? 1 : 0;
+		}
+		else
+		{
+			canvas.Clear();
+		}
+
+		for (++keyframe; keyframe <= target; ++keyframe)
+		{
+			ApplySteps((keyframe - 1) * m_KeyframeSteps, keyframe * m_KeyframeSteps, canvas);
+			StoreKeyframe(keyframe, canvas);
+		}
+		ApplySteps(target * m_KeyframeSteps, applied_steps, canvas);
+		return !m_Failed;
+	}
+
+	// what is resident now: the index, the cached blocks and the keyframes
+	uint64_t MemoryBytes() const
+	{
+		uint64_t bytes = m_Stats.index_bytes;
+		for (const auto& block : m_Blocks)
+			bytes += block.records.capacity() * sizeof(PlaceDiff);
+		for (const auto& keyframe : m_Keyframes)
+			bytes += keyframe.canvas.SizeBytes();
+		return bytes;
+	}
+
+	uint64_t					StepCount() const	{ return m_StepOffsets.empty() ? 0 : m_StepOffsets.size() - 1; }
+	uint64_t					RecordCount() const	{ return m_StepOffsets.empty() ? 0 : m_StepOffsets.back(); }
+	uint64_t					KeyframeSteps() const { return m_KeyframeSteps; }
+	bool						Failed() const		{ return m_Failed; }
+	const DiffValidationReport&	Report() const		{ return m_Report; }
+	const PagedTimelineStats&	Stats() const		{ return m_Stats; }
+
+private:
+	static const uint32_t no_slot = UINT32_MAX;
+
+	class BlockSlot
+	{
+	public:
+		uint64_t				block = 0;
+		uint64_t				last_use = 0;
+		std::vector<PlaceDiff>	records;
+	};
+
+	class KeyframeSlot
+	{
+	public:
+		explicit KeyframeSlot(const PlaceCanvasT<ColorCount>& snapshot)
+			: canvas(snapshot)
+		{
+		}
+
+		uint64_t				keyframe = 0;
+		uint64_t				last_use = 0;
+		PlaceCanvasT<ColorCount>	canvas;
+	};
+
+	// the file records of one block, 0 if they can't be read
+	uint64_t ReadBlock(uint64_t block, PlaceDiff* dest)
+	{
+		const uint64_t first = block * m_BlockRecords;
+		const uint64_t count = (std::min)(m_BlockRecords, m_FileRecords - first);
+		m_File.clear();
+		m_File.seekg(static_cast<std::streamoff>(first * sizeof(PlaceDiff)), std::ios::beg);
+		m_File.read(reinterpret_cast<char*>(dest), static_cast<std::streamsize>(count * sizeof(PlaceDiff)));
+		return m_File.good() ? count : 0;
+	}
+
+	// the kept records of a block, read into the least recently used slot when they aren't cached
+	const PlaceDiff* Block(uint64_t block)
+	{
+		uint32_t slot = m_BlockSlot[block];
+		if (slot != no_slot)
+		{
+			++m_Stats.block_hits;
+			m_Blocks[slot].last_use = ++m_Tick;
+			return m_Blocks[slot].records.data();
+		}
+
+		stage_trace::TraceScope trace("read", m_BlockRecords);
+		if (m_Blocks.size() < m_CacheBlocks)
+		{
+			slot = static_cast<uint32_t>(m_Blocks.size());
+			m_Blocks.emplace_back();
+			m_Blocks.back().records.resize(static_cast<size_t>(m_BlockRecords));
+		}
+		else
+		{
+			slot = LeastRecentlyUsed(m_Blocks);
+			m_BlockSlot[m_Blocks[slot].block] = no_slot;
+		}
+
+		// the same records the scan kept, the scan already reported what was dropped
+		BlockSlot& cached = m_Blocks[slot];
+		const uint64_t count = ReadBlock(block, cached.records.data());
+		DiffValidationReport report;
+		const uint64_t kept = SanitizeRecords(cached.records.data(), count, m_Width, m_Height, m_ColorCount, report);
+		if (count == 0 || kept != m_BlockStarts[block + 1] - m_BlockStarts[block])
+		{
+			m_Failed = true;
+			return nullptr;
+		}
+
+		++m_Stats.block_reads;
+		m_Stats.bytes_read += count * sizeof(PlaceDiff);
+		cached.block = block;
+		cached.last_use = ++m_Tick;
+		m_BlockSlot[block] = slot;
+		return cached.records.data();
+	}
+
+	void ApplySteps(uint64_t first_step, uint64_t last_step, PlaceCanvasT<ColorCount>& canvas)
+	{
+		for (uint64_t step = first_step; step < last_step; ++step)
+			canvas.Apply(Step(step));
+	}
+
+	void StoreKeyframe(uint64_t keyframe, const PlaceCanvasT<ColorCount>& canvas)
+	{
+		if (m_MaxKeyframes == 0)
+			return;
+
+		uint32_t slot = 0;
+		if (m_Keyframes.size() < m_MaxKeyframes)
+		{
+			slot = static_cast<uint32_t>(m_Keyframes.size());
+			m_Keyframes.emplace_back(canvas);
+		}
+		else
+		{
+			slot = LeastRecentlyUsed(m_Keyframes);
+			m_KeyframeSlot[m_Keyframes[slot].keyframe] = no_slot;
+			m_Keyframes[slot].canvas = canvas;
+			++m_Stats.keyframes_evicted;
+		}
+
+		++m_Stats.keyframes_built;
+		m_Keyframes[slot].keyframe = keyframe;
+		m_Keyframes[slot].last_use = ++m_Tick;
+		m_KeyframeSlot[keyframe] = slot;
+	}
+
+	template <typename Slot>
+	static uint32_t LeastRecentlyUsed(const std::vector<Slot>& slots)
+	{
+		const auto oldest = std::min_element(slots.begin(), slots.end(), [](const Slot& a, const Slot& b) { return a.last_use < b.last_use; });
+		return static_cast<uint32_t>(oldest - slots.begin());
+	}
+
+	std::ifstream				m_File;
+	uint32_t					m_Width;
+	uint32_t					m_Height;
+	uint32_t					m_ColorCount;
+	uint64_t					m_FileRecords;
+	uint64_t					m_BlockRecords;
+	uint64_t					m_KeyframeSteps;
+	uint64_t					m_CacheBlocks;
+	uint64_t					m_MaxKeyframes;
+	uint64_t					m_Tick;			// use counter the slots are stamped with
+	bool						m_Failed;
+	std::vector<uint64_t>		m_StepOffsets;	// first kept record of every step, then the kept record count
+	std::vector<uint64_t>		m_BlockStarts;	// first kept record of every file block, then the kept record count
+	std::vector<uint32_t>		m_BlockSlot;	// cache slot of every block, no_slot if it isn't cached
+	std::vector<uint32_t>		m_KeyframeSlot;	// slot of every keyframe, no_slot if it isn't resident
+	std::vector<BlockSlot>		m_Blocks;
+	std::vector<KeyframeSlot>	m_Keyframes;
+	std::vector<PlaceDiff>		m_StepBuffer;	// a step spanning blocks, gathered
+	DiffValidationReport		m_Report;
+	PagedTimelineStats			m_Stats;
+};
+
+template <uint32_t ColorCount>
+const uint32_t PagedTimelineT<ColorCount>::no_slot;
+
+using PagedTimeline = PagedTimelineT<16>;
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <inttypes.h>
+
+#ifndef _M_CEE
+#include <thread>
+#include <vector>
+#endif
+
+// worker count used when the caller asks for 0 threads
+inline uint32_t DefaultThreadCount()
+{
+#ifndef _M_CEE
+	const uint32_t hardware_threads = std::thread::hardware_concurrency();
+	return hardware_threads > 0 ? hardware_threads : 1;
+#else
+	return 1;
+#endif
+}
+
+// runs fn(worker) for every worker in [0, worker_count) concurrently and waits for all of
+// them. <thread> is not available to managed (/clr) code, there the workers run one by one.
+template <typename WorkerFn>
+void RunParallel(uint32_t worker_count, WorkerFn&& fn)
+{
+#ifndef _M_CEE
+	std::vector<std::thread> workers;
+	for (uint32_t worker = 1; worker < worker_count; ++worker)
+		workers.emplace_back([&fn, worker]() { fn(worker); });
+
+	if (worker_count > 0)
+		fn(0);
+
+	for (auto& thread : workers)
+		thread.join();
+#else
+	for (uint32_t worker = 0; worker < worker_count; ++worker)
+		fn(worker);
+#endif
+}
+
+// the part of [0, total) that worker owns when it is split into worker_count contiguous ranges
+inline void SplitRange(uint64_t total, uint32_t worker_count, uint32_t worker, uint64_t& begin, uint64_t& end)
+{
+	begin = total * worker / worker_count;
+	end = total * (worker + 1) / worker_count;
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "diff_timeline.h"
+#include "parallel.h"
+#include "place_canvas.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+class PixelHistoryHeader
+{
+public:
+	char		magic[4];			// "PXI1"
+	uint32_t	version;
+	uint32_t	width;
+	uint32_t	height;
+	uint64_t	source_records;		// record count of the archive the index was built from
+	uint64_t	entry_count;		// records that were drawn, the size of the history
+};
+
+static_assert(sizeof(PixelHistoryHeader) == 32, "PixelHistoryHeader is written to disk as is");
+
+// every drawn record ordered by pixel, then by time. the history of pixel p is
+// [m_Offsets[p], m_Offsets[p + 1]) of the timestamp and color arrays, so the color
+// of a pixel at time t is one binary search over that pixel's changes.
+class PixelHistory
+{
+public:
+	PixelHistory()
+		: m_Width(0)
+		, m_Height(0)
+		, m_SourceRecords(0)
+	{
+	}
+
+	// parallel stable counting sort: workers count their slice of the timeline per pixel,
+	// the counts become every worker's write cursor in each pixel's range, then every
+	// worker scatters its slice. records keep timeline order within a pixel.
+	void Build(const DiffTimeline& timeline, int32_t width, int32_t height, uint32_t thread_count = 0)
+	{
+		m_Width = width;
+		m_Height = height;
+		m_SourceRecords = timeline.RecordCount();
+
+		const uint64_t pixel_count = static_cast<uint64_t>(width) * height;
+		const uint64_t step_count = timeline.StepCount();
+		const uint32_t workers = static_cast<uint32_t>((std::max)(static_cast<uint64_t>(1),
+			(std::min)(static_cast<uint64_t>(thread_count > 0 ? thread_count : DefaultThreadCount()), step_count)));
+
+		// workers own whole steps
+		std::vector<uint64_t> first_steps(workers + 1, step_count);
+		for (uint32_t worker = 0; worker < workers; ++worker)
+		{
+			uint64_t begin = 0;
+			uint64_t end = 0;
+			SplitRange(timeline.RecordCount(), workers, worker, begin, end);
+			const auto& offsets = timeline.StepOffsets();
+			first_steps[worker] = static_cast<uint64_t>(std::lower_bound(offsets.begin(), offsets.end() - 1, begin) - offsets.begin());
+		}
+
+		std::vector<std::vector<uint64_t>> cursors(workers);
+		RunParallel(workers, [&](uint32_t worker)
+		{
+			std::vector<uint64_t>& counts = cursors[worker];
+			counts.assign(static_cast<size_t>(pixel_count), 0);
+			timeline.ForEachRecord(first_steps[worker], first_steps[worker + 1], [&counts, width](const PlaceDiff& diff)
+			{
+				++counts[static_cast<uint64_t>(diff.y) * width + diff.x];
+			});
+		});
+
+		m_Offsets.assign(static_cast<size_t>(pixel_count + 1), 0);
+		uint64_t total = 0;
+		for (uint64_t pixel = 0; pixel < pixel_count; ++pixel)
+		{
+			m_Offsets[pixel] = total;
+			for (auto& counts : cursors)
+			{
+				const uint64_t count = counts[pixel];
+				counts[pixel] = total;
+				total += count;
+			}
+		}
+		m_Offsets[pixel_count] = total;
+
+		m_Timestamps.resize(static_cast<size_t>(total));
+		m_Colors.resize(static_cast<size_t>(total));
+		RunParallel(workers, [&](uint32_t worker)
+		{
+			std::vector<uint64_t>& cursor = cursors[worker];
+			timeline.ForEachRecord(first_steps[worker], first_steps[worker + 1], [this, &cursor, width](const PlaceDiff& diff)
+			{
+				const uint64_t entry = cursor[static_cast<uint64_t>(diff.y) * width + diff.x]++;
+				m_Timestamps[entry] = diff.timestamp;
+				m_Colors[entry] = static_cast<uint8_t>(diff.color);
+			});
+		});
+	}
+
+	// palette index of (x, y) once every step with a timestamp <= t has been applied
+	uint8_t ColorAt(uint32_t x, uint32_t y, uint32_t t) const
+	{
+		const uint64_t pixel = static_cast<uint64_t>(y) * m_Width + x;
+		const uint32_t* history_begin = m_Timestamps.data() + m_Offsets[pixel];
+		const uint32_t* history_end = m_Timestamps.data() + m_Offsets[pixel + 1];
+		const uint32_t* next = std::upper_bound(history_begin, history_end, t);
+		return (next == history_begin) ? static_cast<uint8_t>(White) : m_Colors[next - 1 - m_Timestamps.data()];
+	}
+
+	// number of times (x, y) was drawn over the whole timeline
+	uint64_t ChangeCount(uint32_t x, uint32_t y) const
+	{
+		const uint64_t pixel = static_cast<uint64_t>(y) * m_Width + x;
+		return m_Offsets[pixel + 1] - m_Offsets[pixel];
+	}
+
+	bool Save(const std::string& path) const
+	{
+		std::ofstream index_file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!index_file.is_open())
+			return false;
+
+		PixelHistoryHeader header;
+		std::memcpy(header.magic, "PXI1", sizeof(header.magic));
+		header.version = 1;
+		header.width = static_cast<uint32_t>(m_Width);
+		header.height = static_cast<uint32_t>(m_Height);
+		header.source_records = m_SourceRecords;
+		header.entry_count = m_Timestamps.size();
+
+		index_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		index_file.write(reinterpret_cast<const char*>(m_Offsets.data()), m_Offsets.size() * sizeof(uint64_t));
+		index_file.write(reinterpret_cast<const char*>(m_Timestamps.data()), m_Timestamps.size() * sizeof(uint32_t));
+		index_file.write(reinterpret_cast<const char*>(m_Colors.data()), m_Colors.size());
+		return index_file.good();
+	}
+
+	// fails if the file is missing, damaged or was built from an archive with a different record count
+	bool Load(const std::string& path, const DiffTimeline& timeline, int32_t width, int32_t height)
+	{
+		std::ifstream index_file(path, std::ios::in | std::ios::binary);
+		if (!index_file.is_open())
+			return false;
+
+		PixelHistoryHeader header;
+		index_file.read(reinterpret_cast<char*>(&header), sizeof(header));
+		if (!index_file.good() || std::memcmp(header.magic, "PXI1", sizeof(header.magic)) != 0 || header.version != 1
+			|| header.width != static_cast<uint32_t>(width) || header.height != static_cast<uint32_t>(height)
+			|| header.source_records != timeline.RecordCount() || header.entry_count > header.source_records)
+			return false;
+
+		m_Width = width;
+		m_Height = height;
+		m_SourceRecords = header.source_records;
+		m_Offsets.resize(static_cast<size_t>(static_cast<uint64_t>(width) * height + 1));
+		m_Timestamps.resize(static_cast<size_t>(header.entry_count));
+		m_Colors.resize(static_cast<size_t>(header.entry_count));
+		index_file.read(reinterpret_cast<char*>(m_Offsets.data()), m_Offsets.size() * sizeof(uint64_t));
+		index_file.read(reinterpret_cast<char*>(m_Timestamps.data()), m_Timestamps.size() * sizeof(uint32_t));
+		index_file.read(reinterpret_cast<char*>(m_Colors.data()), m_Colors.size());
+		if (!index_file.good() || !Consistent(header.entry_count))
+		{
+			m_Offsets.clear();
+			m_Timestamps.clear();
+			m_Colors.clear();
+			return false;
+		}
+
+		return true;
+	}
+
+	uint64_t EntryCount() const
+	{
+		return m_Timestamps.size();
+	}
+
+	uint64_t MemoryBytes() const
+	{
+		return m_Offsets.capacity() * sizeof(uint64_t) + m_Timestamps.capacity() * sizeof(uint32_t) + m_Colors.capacity();
+	}
+
+private:
+	// the offsets start at 0, never decrease and end at entry_count, so every pixel's history lies
+	// inside the entries, and every entry holds a palette index
+	bool Consistent(uint64_t entry_count) const
+	{
+		if (m_Offsets.front() != 0 || m_Offsets.back() != entry_count)
+			return false;
+		for (size_t pixel = 1; pixel < m_Offsets.size(); ++pixel)
+			if (m_Offsets[pixel] < m_Offsets[pixel - 1])
+				return false;
+		for (const uint8_t color : m_Colors)
+			if (color >= PlaceCanvas::palette_size)
+				return false;
+		return true;
+	}
+
+	int32_t					m_Width;
+	int32_t					m_Height;
+	uint64_t				m_SourceRecords;
+	std::vector<uint64_t>	m_Offsets;
+	std::vector<uint32_t>	m_Timestamps;
+	std::vector<uint8_t>	m_Colors;
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "diff_timeline.h"
+
+#include <algorithm>
+#include <vector>
+#include <inttypes.h>
+
+// the r/place canvas as palette indices. palettes of up to 16 colors store two
+// pixels per byte with the even column in the low nibble, larger ones a byte per
+// pixel. rows are stored top to bottom in one buffer, a zeroed canvas is all
+// index 0 (white in the 2017 palette).
+template <uint32_t ColorCount>
+class PlaceCanvasT
+{
+public:
+	static_assert(ColorCount >= 2 && ColorCount < 256, "palette indices are bytes and 0xFF marks no prior color");
+
+	static const uint32_t palette_size = ColorCount;
+	static const uint32_t bits_per_pixel = (ColorCount <= 16) ? 4 : 8;
+	static const uint8_t no_prior_color = 0xFF;
+
+	PlaceCanvasT(int32_t width, int32_t height)
+		: m_Width(width)
+		, m_Height(height)
+		, m_RowBytes(bits_per_pixel == 4 ? (width + 1) / 2 : width)
+		, m_Indices(static_cast<size_t>(m_RowBytes) * height, 0)
+	{
+	}
+
+	uint8_t Get(uint32_t x, uint32_t y) const
+	{
+		if (bits_per_pixel == 8)
+			return m_Indices[static_cast<size_t>(y) * m_RowBytes + x];
+
+		const uint8_t packed = m_Indices[static_cast<size_t>(y) * m_RowBytes + (x >> 1)];
+		return (packed >> ((x & 1) << 2)) & 0x0F;
+	}
+
+	void Set(uint32_t x, uint32_t y, uint8_t index)
+	{
+		if (bits_per_pixel == 8)
+		{
+			m_Indices[static_cast<size_t>(y) * m_RowBytes + x] = index;
+			return;
+		}
+
+		uint8_t& packed = m_Indices[static_cast<size_t>(y) * m_RowBytes + (x >> 1)];
+		const uint32_t shift = (x & 1) << 2;
+		packed = static_cast<uint8_t>((packed & ~(0x0F << shift)) | (index << shift));
+	}
+
+	// the step must come from a validated archive, records are not range checked
+	void Apply(const DiffStep& timestep)
+	{
+		Apply(timestep, [](uint32_t, uint32_t, uint8_t, uint8_t) {});
+	}
+
+	// same as Apply(), also calls changed(x, y, old_index, new_index) for every pixel it writes
+	template <typename ChangeFn>
+	void Apply(const DiffStep& timestep, ChangeFn&& changed)
+	{
+		for (const auto& pixel : timestep)
+		{
+			const uint8_t index = static_cast<uint8_t>(pixel.color);
+			changed(pixel.x, pixel.y, Get(pixel.x, pixel.y), index);
+			Set(pixel.x, pixel.y, index);
+		}
+	}
+
+	// undoes a step applied by Apply(), prior_colors holds the index each pixel
+	// had before its record was applied or no_prior_color if it was never applied
+	void Revert(const DiffStep& timestep, const uint8_t* prior_colors)
+	{
+		Revert(timestep, prior_colors, [](uint32_t, uint32_t, uint8_t, uint8_t) {});
+	}
+
+	template <typename ChangeFn>
+	void Revert(const DiffStep& timestep, const uint8_t* prior_colors, ChangeFn&& changed)
+	{
+		for (size_t i = timestep.size(); i--; /*empty*/)
+		{
+			const PlaceDiff& pixel = timestep.begin()[i];
+			if (prior_colors[i] != no_prior_color)
+			{
+				changed(pixel.x, pixel.y, Get(pixel.x, pixel.y), prior_colors[i]);
+				Set(pixel.x, pixel.y, prior_colors[i]);
+			}
+		}
+	}
+
+	void Clear()
+	{
+		std::fill(m_Indices.begin(), m_Indices.end(), static_cast<uint8_t>(0));
+	}
+
+	const uint8_t*	Row(int32_t y) const	{ return m_Indices.data() + static_cast<size_t>(y) * m_RowBytes; }
+	const uint8_t*	Data() const		{ return m_Indices.data(); }
+	uint8_t*		Data()				{ return m_Indices.data(); }
+	size_t			SizeBytes() const	{ return m_Indices.size(); }
+	int32_t			Width() const		{ return m_Width; }
+	int32_t			Height() const		{ return m_Height; }
+	int32_t			RowBytes() const	{ return m_RowBytes; }
+
+private:
+	int32_t					m_Width;
+	int32_t					m_Height;
+	int32_t					m_RowBytes;
+	std::vector<uint8_t>	m_Indices;
+};
+
+// the 2017 canvas and everything built on it
+using PlaceCanvas = PlaceCanvasT<16>;
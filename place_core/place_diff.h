@@ -0,0 +1,39 @@
+#pragma once
+
+#include <inttypes.h>
+
+enum DiffColor
+{
+	White = 0,	// #FFFFFF
+	Gray10 = 1,	// #E4E4E4
+	Gray50 = 2,	// #888888
+	Gray90 = 3,	// #222222
+	Pink = 4,	// #FFA7D1
+	Red = 5,	// #E50000
+	Orange = 6,	// #E59500
+	DarkOrange = 7,	// #A06A42
+	Yellow = 8,	// #E5D900
+	LimeGreen = 9,	// #94E044
+	Green = 10,	// #02BE01
+	LightBlue = 11,	// #00D3DD
+	MediumBlue = 12,	// #0083C7
+	Blue = 13,	// #0000EA
+	LightPurle = 14,	// #CF6EE4
+	Purple = 15	// #820080
+};
+
+#pragma pack(push, 2)
+
+// one record of diffs.bin, the layout on disk is the layout in memory
+class PlaceDiff
+{
+public:
+	uint32_t	timestamp;
+	uint32_t	x;
+	uint32_t	y;
+	DiffColor	color;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(PlaceDiff) == 16, "PlaceDiff must match the 16 byte diffs.bin record");
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "canvas_format.h"
+#include "timeline_cursor.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+// a bitmap that moves to any step of a timeline, drawn on the canvas the archive's
+// format describes. the canvas and bitmap specialization is picked once at runtime,
+// every call behind the interface runs the specialized code.
+class PlaceView
+{
+public:
+	virtual ~PlaceView()
+	{
+	}
+
+	// builds the keyframes and undo stream, the view can't seek before this returns
+	virtual void Build(const DiffTimeline& timeline) = 0;
+
+	// the same for a timeline that is still growing: Start() makes the view seekable over the
+	// steps it has, Extend() takes the steps added since. the caller keeps the timeline from
+	// growing while the view seeks
+	virtual void Start(const DiffTimeline& timeline) = 0;
+	virtual void Extend() = 0;
+	virtual bool Ready() const = 0;
+
+	// brings the bitmap to the state after the first applied_steps steps
+	virtual void SeekTo(uint64_t applied_steps) = 0;
+	virtual uint64_t AppliedSteps() const = 0;
+
+	// see BitMapCoreT
+	virtual void EnablePyramid() = 0;
+	virtual const std::vector<char>& GenerateBMPData(uint32_t level = 0) const = 0;
+	virtual bool Write(const std::string& file_path) const = 0;
+
+	virtual int32_t Width() const = 0;
+	virtual int32_t Height() const = 0;
+	virtual uint32_t PaletteSize() const = 0;	// colors of the format's palette, what records are validated against
+
+	// null if the format's palette is larger than any specialization
+	static std::unique_ptr<PlaceView> Create(const CanvasFormat& format);
+};
+
+template <uint32_t ColorCount>
+class PlaceViewT : public PlaceView
+{
+public:
+	explicit PlaceViewT(const CanvasFormat& format)
+		: m_pTimeline(nullptr)
+		, m_Width(format.width)
+		, m_Height(format.height)
+		, m_PaletteSize(format.ColorCount())
+		, m_Bitmap(format.width, format.height)
+	{
+		m_Bitmap.SetPalette(format.palette);
+	}
+
+	void Build(const DiffTimeline& timeline) override
+	{
+		m_Keyframes.Build(timeline, m_Width, m_Height);
+		m_Undo.Build(timeline, m_Width, m_Height);
+		m_pCursor.reset(new TimelineCursorT<ColorCount>(timeline, m_Keyframes, m_Undo, m_Bitmap));
+	}
+
+	void Start(const DiffTimeline& timeline) override
+	{
+		m_pTimeline = &timeline;
+		m_Keyframes.Start(m_Width, m_Height);
+		m_Undo.Start(timeline, m_Width, m_Height);
+		m_pCursor.reset(new TimelineCursorT<ColorCount>(timeline, m_Keyframes, m_Undo, m_Bitmap));
+		Extend();
+	}
+
+	void Extend() override
+	{
+		m_Keyframes.Extend(*m_pTimeline);
+		m_Undo.Extend();
+	}
+
+	bool Ready() const override
+	{
+		return m_pCursor != nullptr;
+	}
+
+	void SeekTo(uint64_t applied_steps) override
+	{
+		m_pCursor->SeekTo(applied_steps);
+	}
+
+	uint64_t AppliedSteps() const override
+	{
+		return m_pCursor ? m_pCursor->AppliedSteps() : 0;
+	}
+
+	void EnablePyramid() override
+	{
+		m_Bitmap.EnablePyramid();
+	}
+
+	const std::vector<char>& GenerateBMPData(uint32_t level) const override
+	{
+		return m_Bitmap.GenerateBMPData(level);
+	}
+
+	bool Write(const std::string& file_path) const override
+	{
+		return m_Bitmap.Write(file_path);
+	}
+
+	int32_t Width() const override		{ return m_Width; }
+	int32_t Height() const override		{ return m_Height; }
+	uint32_t PaletteSize() const override	{ return m_PaletteSize; }
+
+private:
+	const DiffTimeline*							m_pTimeline;
+	int32_t										m_Width;
+	int32_t										m_Height;
+	uint32_t									m_PaletteSize;
+	BitMapCoreT<ColorCount>						m_Bitmap;
+	KeyframeStoreT<ColorCount>					m_Keyframes;
+	UndoStreamT<ColorCount>						m_Undo;
+	std::unique_ptr<TimelineCursorT<ColorCount>>	m_pCursor;
+};
+
+inline std::unique_ptr<PlaceView> PlaceView::Create(const CanvasFormat& format)
+{
+	if (format.ColorCount() <= 16)
+		return std::unique_ptr<PlaceView>(new PlaceViewT<16>(format));
+	if (format.ColorCount() <= 32)
+		return std::unique_ptr<PlaceView>(new PlaceViewT<32>(format));
+	return nullptr;
+}
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+#ifndef _M_CEE
+#include <atomic>
+#include <mutex>
+#endif
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <Psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// built-in stage instrumentation. a TraceScope times the stage it lives in and counts the
+// heap allocations made inside it, TraceCounter() samples a named value. every thread
+// records into its own buffer, so nothing is shared while tracing; when tracing is off a
+// scope costs one relaxed load. once the traced threads are done the events can be saved
+// as a chrome://tracing / Perfetto json file and summed up per stage.
+// allocations are only counted by programs that include allocation_counter.h, which
+// routes operator new to stage_trace::CountAllocation(). <mutex> is not available to managed (/clr) code,
+// there every call compiles to nothing.
+namespace stage_trace
+{
+	// one finished scope or counter sample, times in microseconds since Enable()
+	class TraceEvent
+	{
+	public:
+		const char*	name;			// a string literal, never copied
+		double		begin_us;
+		double		duration_us;	// negative for counter samples
+		int64_t		value;			// allocations of a scope, the sampled value of a counter
+		uint64_t	items;			// records, frames or bytes the scope processed
+	};
+
+	// the events of one thread, kept alive by the registry after the thread exits
+	class ThreadTrace
+	{
+	public:
+		explicit ThreadTrace(uint32_t id)
+			: thread_id(id)
+		{
+			events.reserve(4096);
+		}
+
+		uint32_t				thread_id;
+		std::vector<TraceEvent>	events;
+	};
+
+	class StageSummary
+	{
+	public:
+		const char*	name = nullptr;
+		uint64_t	calls = 0;
+		double		total_ms = 0.0;		// summed over threads, nested stages count in their parent too
+		uint64_t	allocations = 0;
+		uint64_t	items = 0;
+	};
+
+#ifndef _M_CEE
+	class Registry
+	{
+	public:
+		std::atomic<bool>							enabled{ false };
+		std::chrono::steady_clock::time_point		start;
+		std::mutex									mutex;
+		std::vector<std::unique_ptr<ThreadTrace>>	threads;
+	};
+
+	inline Registry& GetRegistry()
+	{
+		static Registry registry;
+		return registry;
+	}
+
+	inline uint64_t& ThreadAllocations()
+	{
+		static thread_local uint64_t allocations = 0;
+		return allocations;
+	}
+
+	// the calling thread's buffer, registered on its first event
+	inline ThreadTrace& CurrentThread()
+	{
+		static thread_local ThreadTrace* trace = nullptr;
+		if (trace == nullptr)
+		{
+			Registry& registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+			registry.threads.emplace_back(new ThreadTrace(static_cast<uint32_t>(registry.threads.size())));
+			trace = registry.threads.back().get();
+		}
+		return *trace;
+	}
+
+	inline bool Enabled()
+	{
+		return GetRegistry().enabled.load(std::memory_order_relaxed);
+	}
+
+	// starts recording, event times are relative to this call
+	inline void Enable()
+	{
+		Registry& registry = GetRegistry();
+		registry.start = std::chrono::steady_clock::now();
+		registry.enabled.store(true, std::memory_order_relaxed);
+	}
+
+	inline void Disable()
+	{
+		GetRegistry().enabled.store(false, std::memory_order_relaxed);
+	}
+
+	inline double NowUs()
+	{
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - GetRegistry().start).count();
+	}
+
+	// call from operator new
+	inline void CountAllocation()
+	{
+		++ThreadAllocations();
+	}
+
+	inline void TraceCounter(const char* name, int64_t value)
+	{
+		if (Enabled())
+			CurrentThread().events.push_back(TraceEvent{ name, NowUs(), -1.0, value, 0 });
+	}
+
+	// times the rest of the enclosing block as stage name
+	class TraceScope
+	{
+	public:
+		explicit TraceScope(const char* name, uint64_t items = 0)
+			: m_Name(Enabled() ? name : nullptr)
+			, m_Items(items)
+			, m_BeginUs(0.0)
+			, m_Allocations(0)
+		{
+			if (m_Name != nullptr)
+			{
+				m_Allocations = ThreadAllocations();
+				m_BeginUs = NowUs();
+			}
+		}
+
+		TraceScope(const TraceScope&) = delete;
+		TraceScope& operator=(const TraceScope&) = delete;
+
+		~TraceScope()
+		{
+			if (m_Name != nullptr)
+			{
+				const double end_us = NowUs();
+				const int64_t allocations = static_cast<int64_t>(ThreadAllocations() - m_Allocations);
+				CurrentThread().events.push_back(TraceEvent{ m_Name, m_BeginUs, end_us - m_BeginUs, allocations, m_Items });
+			}
+		}
+
+		// for scopes that only learn how much they processed at the end
+		void SetItems(uint64_t items)
+		{
+			m_Items = items;
+		}
+
+	private:
+		const char*	m_Name;
+		uint64_t	m_Items;
+		double		m_BeginUs;
+		uint64_t	m_Allocations;
+	};
+
+	// every traced stage, in the order it was first seen. only call once the traced threads are done
+	inline std::vector<StageSummary> Summarize()
+	{
+		std::vector<StageSummary> stages;
+		Registry& registry = GetRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		for (const auto& thread : registry.threads)
+		{
+			for (const auto& event : thread->events)
+			{
+				if (event.duration_us < 0.0)
+					continue;
+
+				// names are literals, but the same literal may live at several addresses
+				auto stage = std::find_if(stages.begin(), stages.end(), [&event](const StageSummary& summary)
+					{ return summary.name == event.name || std::string(summary.name) == event.name; });
+				if (stage == stages.end())
+				{
+					stages.emplace_back();
+					stage = stages.end() - 1;
+					stage->name = event.name;
+				}
+
+				++stage->calls;
+				stage->total_ms += event.duration_us / 1000.0;
+				stage->allocations += static_cast<uint64_t>(event.value);
+				stage->items += event.items;
+			}
+		}
+		return stages;
+	}
+
+	// writes every event in the chrome trace event format, scopes as complete ("X") events
+	inline bool WriteChromeTrace(const std::string& path)
+	{
+		std::ofstream json_file(path, std::ios::out | std::ios::trunc);
+		if (!json_file.is_open())
+			return false;
+
+		Registry& registry = GetRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		json_file << std::fixed << std::setprecision(3) << "{\"traceEvents\":[" << std::endl;
+		bool first = true;
+		for (const auto& thread : registry.threads)
+		{
+			for (const auto& event : thread->events)
+			{
+				json_file << (first ? "" : ",\n") << "{\"name\":\"" << event.name << "\",\"pid\":1,\"tid\":" << thread->thread_id
+					<< ",\"ts\":" << event.begin_us;
+				if (event.duration_us < 0.0)
+					json_file << ",\"ph\":\"C\",\"args\":{\"value\":" << event.value << "}}";
+				else
+					json_file << ",\"ph\":\"X\",\"dur\":" << event.duration_us << ",\"args\":{\"allocations\":" << event.value
+						<< ",\"items\":" << event.items << "}}";
+				first = false;
+			}
+		}
+		json_file << std::endl << "]}" << std::endl;
+		return json_file.good();
+	}
+#else
+	inline bool Enabled()								{ return false; }
+	inline void Enable()								{ }
+	inline void Disable()								{ }
+	inline void CountAllocation()						{ }
+	inline void TraceCounter(const char*, int64_t)		{ }
+	inline std::vector<StageSummary> Summarize()		{ return std::vector<StageSummary>(); }
+	inline bool WriteChromeTrace(const std::string&)	{ return false; }
+
+	class TraceScope
+	{
+	public:
+		explicit TraceScope(const char*, uint64_t = 0)	{ }
+		void SetItems(uint64_t)						{ }
+	};
+#endif
+
+	// the largest resident set the process has had so far, 0 where it can't be read
+	inline uint64_t PeakRssBytes()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+			return counters.PeakWorkingSetSize;
+		return 0;
+#else
+		rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+			return 0;
+#ifdef __APPLE__
+		return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+		return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+	}
+
+	// starts the peak over at the current resident set, so PeakRssBytes() only covers what runs
+	// next. false where the os keeps one peak for the whole process, which is everywhere but linux
+	inline bool ResetPeakRss()
+	{
+#ifdef __linux__
+		std::ofstream clear_refs("/proc/self/clear_refs");
+		clear_refs << "5";
+		clear_refs.close();
+		return !clear_refs.fail();
+#else
+		return false;
+#endif
+	}
+
+	// one line per stage: calls, time, share of the wall time, throughput and allocations
+	inline void PrintSummary(std::ostream& out, double wall_ms)
+	{
+		out << std::left << std::setw(12) << "stage" << std::right << std::setw(10) << "calls" << std::setw(12) << "total ms"
+			<< std::setw(8) << "wall %" << std::setw(12) << "mean us" << std::setw(14) << "items/s" << std::setw(12) << "allocs" << std::endl;
+		for (const auto& stage : Summarize())
+		{
+			out << std::left << std::setw(12) << stage.name << std::right << std::setw(10) << stage.calls
+				<< std::setw(12) << std::fixed << std::setprecision(1) << stage.total_ms
+				<< std::setw(8) << (wall_ms > 0.0 ? 100.0 * stage.total_ms / wall_ms : 0.0)
+				<< std::setw(12) << (stage.calls > 0 ? stage.total_ms * 1000.0 / stage.calls : 0.0)
+				<< std::setw(14) << std::setprecision(0) << (stage.total_ms > 0.0 ? stage.items * 1000.0 / stage.total_ms : 0.0)
+				<< std::setw(12) << stage.allocations << std::endl;
+		}
+		out.unsetf(std::ios::floatfield);
+		out << std::setprecision(6) << "wall " << wall_ms << " ms, peak rss " << PeakRssBytes() / (1024.0 * 1024.0) << " MB" << std::endl;
+	}
+}
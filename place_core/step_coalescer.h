@@ -0,0 +1,70 @@
+#pragma once
+
+#include "diff_timeline.h"
+
+#include <algorithm>
+#include <vector>
+#include <inttypes.h>
+
+// collapses a range of steps into one step that writes every pixel once, with the
+// color of the last record for it. applying the result draws the same canvas as
+// applying the steps one by one. pixels are marked with a generation counter
+// instead of being cleared between ranges, and the record buffer is reused, so
+// coalescing allocates nothing once the buffer has grown to the busiest range.
+class StepCoalescer
+{
+public:
+	StepCoalescer(int32_t width, int32_t height)
+		: m_Width(width)
+		, m_Height(height)
+		, m_Marks(static_cast<size_t>(width) * height, 0)
+		, m_Generation(0)
+		, m_InputRecords(0)
+		, m_OutputRecords(0)
+	{
+	}
+
+	// the last write to every pixel drawn by steps [first_step, last_step) of timeline, in archive order.
+	// valid until the next call
+	DiffStep Coalesce(const DiffTimeline& timeline, uint64_t first_step, uint64_t last_step)
+	{
+		if (++m_Generation == 0)
+		{
+			std::fill(m_Marks.begin(), m_Marks.end(), 0u);
+			m_Generation = 1;
+		}
+
+		m_Records.clear();
+
+		// walking backwards, the first record seen for a pixel is the one that wins
+		const PlaceDiff* first = timeline.Records() + timeline.StepOffsets()[first_step];
+		const PlaceDiff* last = timeline.Records() + timeline.StepOffsets()[last_step];
+		m_InputRecords += static_cast<uint64_t>(last - first);
+		for (const PlaceDiff* diff = last; diff-- != first; /*empty*/)
+		{
+			uint32_t& mark = m_Marks[static_cast<size_t>(diff->y) * m_Width + diff->x];
+			if (mark != m_Generation)
+			{
+				mark = m_Generation;
+				m_Records.push_back(*diff);
+			}
+		}
+
+		std::reverse(m_Records.begin(), m_Records.end());
+		m_OutputRecords += m_Records.size();
+		return DiffStep(m_Records.data(), m_Records.data() + m_Records.size());
+	}
+
+	// records read and records handed out, summed over every Coalesce() call
+	uint64_t InputRecords() const	{ return m_InputRecords; }
+	uint64_t OutputRecords() const	{ return m_OutputRecords; }
+
+private:
+	int32_t					m_Width;
+	int32_t					m_Height;
+	std::vector<uint32_t>	m_Marks;		// generation that last wrote each pixel
+	uint32_t				m_Generation;
+	std::vector<PlaceDiff>	m_Records;
+	uint64_t				m_InputRecords;
+	uint64_t				m_OutputRecords;
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "diff_timeline.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <inttypes.h>
+
+class StepPipelineStats
+{
+public:
+	double		first_step_ms = 0.0;	// from Start() until the first step was published
+	double		load_ms = 0.0;			// from Start() until the whole archive was read
+	uint64_t	blocks = 0;				// blocks read, each one publishes the steps it completed
+};
+
+// streaming load: a loader thread reads the archive block by block and extends the
+// timeline, publishing every step that can no longer grow. consumers wait for steps
+// with WaitForSteps() and take them with Step() while the rest of the file is read.
+// the timeline's step index moves as it grows, so until Finish() returns it is only
+// reached through the pipeline. <thread> is not available to managed (/clr) code,
+// the gui drives DiffArchive::ReadNext() and DiffTimeline::Extend() itself.
+class StepPipeline
+{
+public:
+	StepPipeline()
+		: m_Published(0)
+		, m_Done(false)
+		, m_Failed(false)
+	{
+	}
+
+	StepPipeline(const StepPipeline&) = delete;
+	StepPipeline& operator=(const StepPipeline&) = delete;
+
+	~StepPipeline()
+	{
+		Finish();
+	}
+
+	// opens the archive streamed and starts reading it, false if it can't be opened.
+	// every block is validated against a width x height canvas with color_count colors as it arrives
+	bool Start(const std::string& path, int32_t width, int32_t height, uint32_t color_count)
+	{
+		m_Start = std::chrono::steady_clock::now();
+		if (!m_Archive.Open(path, DiffArchive::LoadMode::Streamed))
+			return false;
+
+		m_Archive.Validate(width, height, color_count);
+		m_Timeline.Start(m_Archive);
+		m_Loader = std::thread([this]() { LoaderLoop(); });
+		return true;
+	}
+
+	// blocks until more than known_steps steps are published or loading is over, returns the published count.
+	// a return value equal to known_steps means no more steps will come
+	uint64_t WaitForSteps(uint64_t known_steps)
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_StepsReady.wait(lock, [this, known_steps]() { return m_Published > known_steps || m_Done; });
+		return m_Published;
+	}
+
+	// a published step, its records stay where they are for the lifetime of the archive
+	DiffStep Step(uint64_t index)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Timeline.Step(index);
+	}
+
+	// waits for the loader, false if the archive could not be read to the end
+	bool Finish()
+	{
+		if (m_Loader.joinable())
+			m_Loader.join();
+		return !m_Failed;
+	}
+
+	// only safe to use once Finish() has returned
+	const DiffArchive&			Archive() const		{ return m_Archive; }
+	const DiffTimeline&			Timeline() const	{ return m_Timeline; }
+	const StepPipelineStats&	Stats() const		{ return m_Stats; }
+
+private:
+	void LoaderLoop()
+	{
+		bool read = true;
+		while (read && !m_Archive.Complete())
+		{
+			read = m_Archive.ReadNext();
+			if (read)
+				++m_Stats.blocks;
+
+			// the records are final before they are scanned, only the step index needs the lock
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			if (m_Timeline.Extend(m_Archive.Loaded(), !read || m_Archive.Complete()) > 0)
+			{
+				if (m_Published == 0)
+					m_Stats.first_step_ms = ElapsedMs();
+				m_Published = m_Timeline.StepCount();
+				m_StepsReady.notify_all();
+			}
+			stage_trace::TraceCounter("published steps", static_cast<int64_t>(m_Published));
+		}
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Timeline.Extend(m_Archive.Loaded(), true);
+		m_Published = m_Timeline.StepCount();
+		m_Failed = !read;
+		m_Done = true;
+		m_Stats.load_ms = ElapsedMs();
+		m_StepsReady.notify_all();
+	}
+
+	double ElapsedMs() const
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_Start).count();
+	}
+
+	DiffArchive								m_Archive;
+	DiffTimeline							m_Timeline;
+	std::thread								m_Loader;
+	std::mutex								m_Mutex;
+	std::condition_variable					m_StepsReady;
+	uint64_t								m_Published;
+	bool									m_Done;
+	bool									m_Failed;
+	std::chrono::steady_clock::time_point	m_Start;
+	StepPipelineStats						m_Stats;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "diff_timeline.h"
+
+#include <algorithm>
+#include <vector>
+#include <inttypes.h>
+
+// orders the records of a step, or of a range of steps, by row. a stable counting
+// sort on y keeps the records of one pixel in archive order, so applying the result
+// still leaves the last write to every pixel. a large batch then touches the canvas
+// and the encoded bitmap top to bottom, one row at a time, instead of all over the
+// place; within a row the writes stay close enough not to need sorting by x as well.
+// batches are sorted in slices of a sixteenth of the pixel count, dense enough for
+// neighbouring writes to share cache lines, and the buffer never outgrows one.
+// this only pays off for batches of a slice or more on an image that no longer fits
+// in the cache, anything else takes the scattered writes faster than it is sorted.
+class StepSorter
+{
+public:
+	static const uint64_t min_target_bytes = 16 * 1024 * 1024;
+
+	StepSorter(int32_t width, int32_t height)
+		: m_RowStarts(static_cast<size_t>(height) + 1, 0)
+		, m_SliceRecords(static_cast<size_t>((std::max)(static_cast<uint64_t>(width) * height / 16, static_cast<uint64_t>(64 * 1024))))
+	{
+	}
+
+	// the smallest batch worth sorting into an image of target_bytes, SIZE_MAX when it is small enough to stay cached
+	size_t Threshold(uint64_t target_bytes) const
+	{
+		return target_bytes < min_target_bytes ? SIZE_MAX : m_SliceRecords;
+	}
+
+	// the buffer for a whole slice, sorting never allocates after this
+	void Reserve()
+	{
+		m_Records.reserve(m_SliceRecords);
+	}
+
+	// calls apply(sorted) for every slice of step, in order. applying the
+	// slices one after the other still leaves the last write to every pixel
+	template <typename ApplyFn>
+	void ForEachSlice(const DiffStep& step, ApplyFn&& apply)
+	{
+		for (const PlaceDiff* first = step.begin(); first != step.end(); /*empty*/)
+		{
+			const size_t left = static_cast<size_t>(step.end() - first);
+			const PlaceDiff* last = first + (left < m_SliceRecords ? left : m_SliceRecords);
+			apply(Sort(DiffStep(first, last)));
+			first = last;
+		}
+	}
+
+	// the records of step ordered by row, archive order within a row. valid until the next call
+	DiffStep Sort(const DiffStep& step)
+	{
+		if (m_Records.capacity() < m_SliceRecords)
+			Reserve();
+
+		m_Records.resize(step.size());
+		std::fill(m_RowStarts.begin(), m_RowStarts.end(), 0u);
+		for (const auto& diff : step)
+			++m_RowStarts[diff.y + 1];
+		for (size_t row = 1; row < m_RowStarts.size(); ++row)
+			m_RowStarts[row] += m_RowStarts[row - 1];
+
+		for (const auto& diff : step)
+			m_Records[m_RowStarts[diff.y]++] = diff;
+
+		return DiffStep(m_Records.data(), m_Records.data() + m_Records.size());
+	}
+
+private:
+	std::vector<uint32_t>	m_RowStarts;	// per row the first slot, then the next one to write
+	std::vector<PlaceDiff>	m_Records;
+	size_t					m_SliceRecords;
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "place_diff.h"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+class SyntheticArchiveOptions
+{
+public:
+	uint32_t	width = 1000;
+	uint32_t	height = 1000;
+	uint64_t	record_count = 1000000;
+	double		records_per_second = 20.0;		// mean records per timestamp, seconds that draw none are left out
+	uint32_t	hotspot_count = 0;				// 0 spreads records uniformly over the canvas
+	double		hotspot_share = 0.9;			// fraction of records placed around a hotspot, the rest stay uniform
+	double		hotspot_radius = 40.0;			// standard deviation of the distance from the hotspot, in pixels
+	uint32_t	color_count = 16;				// colors are drawn from [0, color_count)
+	uint32_t	seed = 1;
+	uint32_t	start_timestamp = 1490918688;	// the first second of the 2017 dump
+};
+
+// writes diffs.bin compatible archives of made up records. every second draws a poisson
+// number of records, which all share that second's timestamp and so form one step.
+// the records go out through a fixed size buffer, so archives of any size can be
+// written in constant memory. the same options always produce the same file.
+class SyntheticArchiveGenerator
+{
+public:
+	static const size_t buffer_records = 64 * 1024;
+
+	explicit SyntheticArchiveGenerator(const SyntheticArchiveOptions& options)
+		: m_Options(options)
+		, m_BytesWritten(0)
+		, m_StepCount(0)
+	{
+	}
+
+	bool Write(const std::string& path)
+	{
+		m_BytesWritten = 0;
+		m_StepCount = 0;
+
+		std::ofstream diffs_file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!diffs_file.is_open() || m_Options.width == 0 || m_Options.height == 0 || m_Options.color_count == 0)
+			return false;
+
+		std::mt19937_64 rng(m_Options.seed);
+		std::poisson_distribution<uint64_t> pick_step_size((std::max)(m_Options.records_per_second, 1e-6));
+		std::uniform_int_distribution<uint32_t> pick_x(0, m_Options.width - 1);
+		std::uniform_int_distribution<uint32_t> pick_y(0, m_Options.height - 1);
+		std::uniform_int_distribution<uint32_t> pick_color(0, m_Options.color_count - 1);
+		std::uniform_real_distribution<double> pick_share(0.0, 1.0);
+		std::normal_distribution<double> pick_offset(0.0, m_Options.hotspot_radius);
+
+		// hotspots sit at random spots, the first ones drawing more records than the later ones
+		std::vector<double> hotspot_x;
+		std::vector<double> hotspot_y;
+		std::vector<double> weights;
+		for (uint32_t hotspot = 0; hotspot < m_Options.hotspot_count; ++hotspot)
+		{
+			hotspot_x.push_back(pick_x(rng));
+			hotspot_y.push_back(pick_y(rng));
+			weights.push_back(1.0 / (hotspot + 1));
+		}
+		std::discrete_distribution<uint32_t> pick_hotspot(weights.begin(), weights.end());
+
+		std::vector<PlaceDiff> buffer;
+		buffer.reserve(buffer_records);
+		uint32_t timestamp = m_Options.start_timestamp - 1;
+		uint64_t step_left = 0;
+		for (uint64_t record = 0; record < m_Options.record_count; ++record)
+		{
+			while (step_left == 0)
+			{
+				++timestamp;
+				step_left = pick_step_size(rng);
+				if (step_left > 0)
+					++m_StepCount;
+			}
+			--step_left;
+
+			PlaceDiff diff;
+			diff.timestamp = timestamp;
+			if (!hotspot_x.empty() && pick_share(rng) < m_Options.hotspot_share)
+			{
+				const uint32_t hotspot = pick_hotspot(rng);
+				diff.x = Clamp(hotspot_x[hotspot] + pick_offset(rng), m_Options.width);
+				diff.y = Clamp(hotspot_y[hotspot] + pick_offset(rng), m_Options.height);
+			}
+			else
+			{
+				diff.x = pick_x(rng);
+				diff.y = pick_y(rng);
+			}
+			diff.color = static_cast<DiffColor>(pick_color(rng));
+			buffer.push_back(diff);
+
+			if (buffer.size() == buffer_records)
+			{
+				if (!Flush(diffs_file, buffer))
+					return false;
+			}
+		}
+
+		return Flush(diffs_file, buffer);
+	}
+
+	uint64_t BytesWritten() const	{ return m_BytesWritten; }
+	uint64_t StepCount() const		{ return m_StepCount; }
+
+private:
+	bool Flush(std::ofstream& diffs_file, std::vector<PlaceDiff>& buffer)
+	{
+		diffs_file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(PlaceDiff));
+		m_BytesWritten += buffer.size() * sizeof(PlaceDiff);
+		buffer.clear();
+		return diffs_file.good();
+	}
+
+	static uint32_t Clamp(double coord, uint32_t size)
+	{
+		return static_cast<uint32_t>((std::min)((std::max)(coord, 0.0), static_cast<double>(size - 1)));
+	}
+
+	SyntheticArchiveOptions	m_Options;
+	uint64_t				m_BytesWritten;
+	uint64_t				m_StepCount;
+};
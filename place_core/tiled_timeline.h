@@ -0,0 +1,205 @@
+#pragma once
+
+#include "diff_timeline.h"
+#include "parallel.h"
+#include "place_canvas.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <inttypes.h>
+
+// a drawn record inside its tile, coordinates relative to the tile corner
+class TileDiff
+{
+public:
+	uint32_t	timestamp;
+	uint8_t		x;
+	uint8_t		y;
+	uint8_t		color;		// palette index, already mapped into the palette
+	uint8_t		reserved;
+};
+
+static_assert(sizeof(TileDiff) == 8, "TileDiff is stored once per record, keep it small");
+
+// the timeline bucketed into tile_size x tile_size tiles. every tile has its own time
+// ordered record list and a keyframe after every keyframe_interval of its records, so
+// rendering a region only reads the tiles it overlaps and at most keyframe_interval
+// records per tile, independent of the rest of the canvas.
+class TiledTimeline
+{
+public:
+	static const int32_t tile_size = 64;
+	static const uint32_t default_keyframe_interval = 256;
+
+	TiledTimeline()
+		: m_Width(0)
+		, m_Height(0)
+		, m_TilesX(0)
+		, m_TilesY(0)
+		, m_KeyframeInterval(default_keyframe_interval)
+	{
+	}
+
+	void Build(const DiffTimeline& timeline, int32_t width, int32_t height, uint32_t keyframe_interval = default_keyframe_interval, uint32_t thread_count = 0)
+	{
+		m_Width = width;
+		m_Height = height;
+		m_TilesX = (width + tile_size - 1) / tile_size;
+		m_TilesY = (height + tile_size - 1) / tile_size;
+		m_KeyframeInterval = keyframe_interval > 0 ? keyframe_interval : 1;
+		const uint64_t tile_count = static_cast<uint64_t>(m_TilesX) * m_TilesY;
+
+		// counting sort of the drawn records by tile, stable so every tile stays in time order
+		m_TileOffsets.assign(static_cast<size_t>(tile_count + 1), 0);
+		timeline.ForEachRecord(0, timeline.StepCount(), [this](const PlaceDiff& diff)
+		{
+			++m_TileOffsets[TileOf(diff.x, diff.y) + 1];
+		});
+		for (uint64_t tile = 0; tile < tile_count; ++tile)
+			m_TileOffsets[tile + 1] += m_TileOffsets[tile];
+
+		std::vector<uint64_t> cursors(m_TileOffsets.begin(), m_TileOffsets.end() - 1);
+		m_Diffs.resize(static_cast<size_t>(m_TileOffsets.back()));
+		timeline.ForEachRecord(0, timeline.StepCount(), [this, &cursors](const PlaceDiff& diff)
+		{
+			TileDiff& tile_diff = m_Diffs[cursors[TileOf(diff.x, diff.y)]++];
+			tile_diff.timestamp = diff.timestamp;
+			tile_diff.x = static_cast<uint8_t>(diff.x % tile_size);
+			tile_diff.y = static_cast<uint8_t>(diff.y % tile_size);
+			tile_diff.color = static_cast<uint8_t>(diff.color);
+			tile_diff.reserved = 0;
+		});
+
+		// keyframe k of a tile is its state after k * interval records, k = 0 is the blank tile and not stored
+		m_KeyframeOffsets.assign(static_cast<size_t>(tile_count + 1), 0);
+		for (uint64_t tile = 0; tile < tile_count; ++tile)
+			m_KeyframeOffsets[tile + 1] = m_KeyframeOffsets[tile] + TileRecordCount(tile) / m_KeyframeInterval;
+
+		const size_t tile_bytes = TileBytes();
+		m_Keyframes.assign(static_cast<size_t>(m_KeyframeOffsets.back()) * tile_bytes, 0);
+		const uint32_t workers = static_cast<uint32_t>((std::min)(static_cast<uint64_t>(thread_count > 0 ? thread_count : DefaultThreadCount()), tile_count));
+		RunParallel(workers, [this, workers, tile_count, tile_bytes](uint32_t worker)
+		{
+			uint64_t first_tile = 0;
+			uint64_t last_tile = 0;
+			SplitRange(tile_count, workers, worker, first_tile, last_tile);
+
+			PlaceCanvas scratch(tile_size, tile_size);
+			for (uint64_t tile = first_tile; tile < last_tile; ++tile)
+			{
+				scratch.Clear();
+				const TileDiff* diffs = m_Diffs.data() + m_TileOffsets[tile];
+				const uint64_t keyframe_count = m_KeyframeOffsets[tile + 1] - m_KeyframeOffsets[tile];
+				for (uint64_t keyframe = 0; keyframe < keyframe_count; ++keyframe)
+				{
+					for (uint32_t i = 0; i < m_KeyframeInterval; ++i, ++diffs)
+						scratch.Set(diffs->x, diffs->y, diffs->color);
+					std::memcpy(m_Keyframes.data() + (m_KeyframeOffsets[tile] + keyframe) * tile_bytes, scratch.Data(), tile_bytes);
+				}
+			}
+		});
+	}
+
+	// fills region, a canvas of the region's size, with the pixels at (x0, y0) once every
+	// step with a timestamp <= t has been applied. returns the number of tiles read.
+	uint32_t RenderRegion(int32_t x0, int32_t y0, uint32_t t, PlaceCanvas& region) const
+	{
+		const int32_t x1 = (std::min)(x0 + region.Width(), m_Width);
+		const int32_t y1 = (std::min)(y0 + region.Height(), m_Height);
+		if (x0 < 0 || y0 < 0 || x0 >= x1 || y0 >= y1)
+			return 0;
+
+		PlaceCanvas scratch(tile_size, tile_size);
+		uint32_t tiles_read = 0;
+		for (int32_t tile_y = y0 / tile_size; tile_y <= (y1 - 1) / tile_size; ++tile_y)
+		{
+			for (int32_t tile_x = x0 / tile_size; tile_x <= (x1 - 1) / tile_size; ++tile_x)
+			{
+				RenderTile(static_cast<uint64_t>(tile_y) * m_TilesX + tile_x, t, scratch);
+				++tiles_read;
+
+				// copy the part of the tile inside the region
+				const int32_t left = (std::max)(x0, tile_x * tile_size);
+				const int32_t right = (std::min)(x1, (tile_x + 1) * tile_size);
+				const int32_t top = (std::max)(y0, tile_y * tile_size);
+				const int32_t bottom = (std::min)(y1, (tile_y + 1) * tile_size);
+				for (int32_t y = top; y < bottom; ++y)
+				{
+					int32_t x = left;
+					if ((x0 & 1) == 0)
+					{
+						// tiles start on even columns, so with an even x0 both rows share nibble alignment
+						const int32_t pair_bytes = (right - left) / 2;
+						std::memcpy(region.Data() + static_cast<size_t>(y - y0) * region.RowBytes() + (left - x0) / 2,
+							scratch.Row(y - tile_y * tile_size) + (left - tile_x * tile_size) / 2, pair_bytes);
+						x += pair_bytes * 2;
+					}
+
+					for (; x < right; ++x)
+						region.Set(x - x0, y - y0, scratch.Get(x - tile_x * tile_size, y - tile_y * tile_size));
+				}
+			}
+		}
+
+		return tiles_read;
+	}
+
+	uint64_t TileCount() const
+	{
+		return static_cast<uint64_t>(m_TilesX) * m_TilesY;
+	}
+
+	uint64_t MemoryBytes() const
+	{
+		return m_TileOffsets.capacity() * sizeof(uint64_t) + m_Diffs.capacity() * sizeof(TileDiff)
+			+ m_KeyframeOffsets.capacity() * sizeof(uint64_t) + m_Keyframes.capacity();
+	}
+
+private:
+	// brings scratch to the tile's state at time t from the closest keyframe before it
+	void RenderTile(uint64_t tile, uint32_t t, PlaceCanvas& scratch) const
+	{
+		const TileDiff* diffs_begin = m_Diffs.data() + m_TileOffsets[tile];
+		const TileDiff* diffs_end = m_Diffs.data() + m_TileOffsets[tile + 1];
+		const TileDiff* applied_end = std::upper_bound(diffs_begin, diffs_end, t, [](uint32_t time, const TileDiff& diff)
+		{
+			return time < diff.timestamp;
+		});
+
+		const uint64_t applied = static_cast<uint64_t>(applied_end - diffs_begin);
+		const uint64_t keyframe = applied / m_KeyframeInterval;
+		if (keyframe > 0)
+			std::memcpy(scratch.Data(), m_Keyframes.data() + (m_KeyframeOffsets[tile] + keyframe - 1) * TileBytes(), TileBytes());
+		else
+			scratch.Clear();
+
+		for (const TileDiff* diff = diffs_begin + keyframe * m_KeyframeInterval; diff != applied_end; ++diff)
+			scratch.Set(diff->x, diff->y, diff->color);
+	}
+
+	uint64_t TileOf(uint32_t x, uint32_t y) const
+	{
+		return static_cast<uint64_t>(y / tile_size) * m_TilesX + x / tile_size;
+	}
+
+	uint64_t TileRecordCount(uint64_t tile) const
+	{
+		return m_TileOffsets[tile + 1] - m_TileOffsets[tile];
+	}
+
+	static size_t TileBytes()
+	{
+		return static_cast<size_t>(tile_size / 2) * tile_size;
+	}
+
+	int32_t					m_Width;
+	int32_t					m_Height;
+	int32_t					m_TilesX;
+	int32_t					m_TilesY;
+	uint32_t				m_KeyframeInterval;
+	std::vector<uint64_t>	m_TileOffsets;		// tile i owns m_Diffs[m_TileOffsets[i], m_TileOffsets[i + 1])
+	std::vector<TileDiff>	m_Diffs;
+	std::vector<uint64_t>	m_KeyframeOffsets;	// tile i owns keyframes [m_KeyframeOffsets[i], m_KeyframeOffsets[i + 1])
+	std::vector<uint8_t>	m_Keyframes;		// TileBytes() of packed indices per keyframe
+};
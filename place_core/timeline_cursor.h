@@ -0,0 +1,95 @@
+#pragma once
+
+#include "bitmap.h"
+#include "diff_timeline.h"
+#include "keyframe_store.h"
+#include "undo_stream.h"
+
+#include <inttypes.h>
+
+// a bitmap positioned on the timeline. it moves to any step count by applying
+// steps forwards, undoing them backwards, or jumping to the closest keyframe,
+// whichever touches the fewest records.
+template <uint32_t ColorCount>
+class TimelineCursorT
+{
+public:
+	TimelineCursorT(const DiffTimeline& timeline, const KeyframeStoreT<ColorCount>& keyframes, const UndoStreamT<ColorCount>& undo, BitMapCoreT<ColorCount>& bitmap)
+		: m_Timeline(timeline)
+		, m_Keyframes(keyframes)
+		, m_Undo(undo)
+		, m_Bitmap(bitmap)
+		, m_AppliedSteps(0)
+	{
+		// restoring a keyframe re-encodes the whole bitmap, which costs about as much as
+		// applying one record for every two pixels, or every sixteen with a simd kernel
+		const uint64_t pixels = static_cast<uint64_t>(bitmap.Canvas().Width()) * bitmap.Canvas().Height();
+		m_RestoreCost = (bitmap.Kernel() == BmpKernel::Scalar) ? pixels / 2 : pixels / 16;
+	}
+
+	// brings the bitmap to the state after the first applied_steps steps
+	void SeekTo(uint64_t applied_steps)
+	{
+		if (applied_steps > m_Timeline.StepCount())
+			applied_steps = m_Timeline.StepCount();
+
+		const KeyframeT<ColorCount>& keyframe = m_Keyframes.Nearest(applied_steps);
+		const uint64_t direct_cost = RecordsBetween(m_AppliedSteps, applied_steps);
+		const uint64_t keyframe_cost = m_RestoreCost + RecordsBetween(keyframe.applied_steps, applied_steps);
+		if (keyframe_cost < direct_cost)
+		{
+			m_Bitmap.SetCanvas(keyframe.canvas);
+			m_AppliedSteps = keyframe.applied_steps;
+		}
+
+		// forwards the steps in between are one batch, large ones get sorted by the bitmap
+		if (m_AppliedSteps < applied_steps)
+		{
+			const std::vector<uint64_t>& offsets = m_Timeline.StepOffsets();
+			m_Bitmap.Update(DiffStep(m_Timeline.Records() + offsets[m_AppliedSteps], m_Timeline.Records() + offsets[applied_steps]));
+			m_AppliedSteps = applied_steps;
+		}
+		while (m_AppliedSteps > applied_steps)
+			StepBackward();
+	}
+
+	void StepForward()
+	{
+		if (m_AppliedSteps < m_Timeline.StepCount())
+			m_Bitmap.Update(m_Timeline.Step(m_AppliedSteps++));
+	}
+
+	void StepBackward()
+	{
+		if (m_AppliedSteps > 0)
+		{
+			--m_AppliedSteps;
+			m_Bitmap.Revert(m_Timeline.Step(m_AppliedSteps), m_Undo.PriorColors(m_AppliedSteps));
+		}
+	}
+
+	// call after changing the bitmap's canvas behind the cursor's back
+	void Reset(uint64_t applied_steps)
+	{
+		m_AppliedSteps = applied_steps;
+	}
+
+	uint64_t			AppliedSteps() const	{ return m_AppliedSteps; }
+	const BitMapCoreT<ColorCount>&	Bitmap() const	{ return m_Bitmap; }
+
+private:
+	uint64_t RecordsBetween(uint64_t from_steps, uint64_t to_steps) const
+	{
+		const std::vector<uint64_t>& offsets = m_Timeline.StepOffsets();
+		return (from_steps < to_steps) ? offsets[to_steps] - offsets[from_steps] : offsets[from_steps] - offsets[to_steps];
+	}
+
+	const DiffTimeline&		m_Timeline;
+	const KeyframeStoreT<ColorCount>&	m_Keyframes;
+	const UndoStreamT<ColorCount>&	m_Undo;
+	BitMapCoreT<ColorCount>&	m_Bitmap;
+	uint64_t				m_AppliedSteps;
+	uint64_t				m_RestoreCost;
+};
+
+using TimelineCursor = TimelineCursorT<16>;
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "diff_timeline.h"
+#include "place_canvas.h"
+
+#include <vector>
+#include <inttypes.h>
+
+// reverse diff stream: for every record of the timeline, the palette index
+// the pixel held right before the record was applied. undoing a step writes
+// those colors back in reverse record order, so moving back costs the same
+// as moving forward. the prior colors are recorded on the canvas the bitmap
+// uses, and like the keyframes they can follow a growing timeline.
+template <uint32_t ColorCount>
+class UndoStreamT
+{
+public:
+	UndoStreamT()
+		: m_pTimeline(nullptr)
+		, m_Canvas(0, 0)
+		, m_BuiltSteps(0)
+	{
+	}
+
+	void Build(const DiffTimeline& timeline, int32_t width, int32_t height)
+	{
+		Start(timeline, width, height);
+		Extend();
+
+		// the timeline is final, the running canvas is not needed anymore
+		m_Canvas = PlaceCanvasT<ColorCount>(0, 0);
+	}
+
+	// an empty stream over timeline, which may still be growing
+	void Start(const DiffTimeline& timeline, int32_t width, int32_t height)
+	{
+		m_pTimeline = &timeline;
+		m_Canvas = PlaceCanvasT<ColorCount>(width, height);
+		m_PriorColors.clear();
+		m_BuiltSteps = 0;
+	}
+
+	// records the prior colors of the steps added to the timeline since the last call
+	void Extend()
+	{
+		const DiffTimeline& timeline = *m_pTimeline;
+		m_PriorColors.resize(static_cast<size_t>(timeline.RecordCount()), static_cast<uint8_t>(PlaceCanvasT<ColorCount>::no_prior_color));
+		for (; m_BuiltSteps < timeline.StepCount(); ++m_BuiltSteps)
+		{
+			const DiffStep diff_step = timeline.Step(m_BuiltSteps);
+			uint8_t* prior_colors = m_PriorColors.data() + timeline.StepOffsets()[m_BuiltSteps];
+			for (const auto& pixel : diff_step)
+			{
+				*prior_colors++ = m_Canvas.Get(pixel.x, pixel.y);
+				m_Canvas.Set(pixel.x, pixel.y, static_cast<uint8_t>(pixel.color));
+			}
+		}
+	}
+
+	// prior colors of the records of one step, parallel to timeline.Step(step)
+	const uint8_t* PriorColors(uint64_t step) const
+	{
+		return m_PriorColors.data() + m_pTimeline->StepOffsets()[step];
+	}
+
+	bool Empty() const
+	{
+		return m_pTimeline == nullptr;
+	}
+
+	uint64_t MemoryBytes() const
+	{
+		return m_PriorColors.capacity() + m_Canvas.SizeBytes();
+	}
+
+private:
+	const DiffTimeline*			m_pTimeline;
+	std::vector<uint8_t>		m_PriorColors;
+	PlaceCanvasT<ColorCount>	m_Canvas;		// the canvas after m_BuiltSteps steps
+	uint64_t					m_BuiltSteps;
+};
+
+using UndoStream = UndoStreamT<16>;
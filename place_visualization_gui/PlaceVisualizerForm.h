@@ -12,6 +12,7 @@
 #include <Windows.h>
 #include <assert.h>
 #include <msclr\marshal_cppstd.h>
+#include <msclr\lock.h>
 
 namespace place_gui 
 {
@@ -22,6 +23,7 @@ namespace place_gui
 	using namespace System::Windows::Forms;
 	using namespace System::Data;
 	using namespace System::Drawing;
+	using namespace System::Drawing::Imaging;
 	using namespace System::Runtime::InteropServices;
 	using namespace System::ComponentModel;
 	using namespace msclr::interop;
@@ -30,11 +32,13 @@ namespace place_gui
 	{
 	public:
 		PlaceVisualizerForm(void)
-			: m_LastBitmapIndex(0)
+			: m_pArchive(nullptr)
 			, m_pForwardDiffData(nullptr)
-			, m_pReverseDiffData(nullptr)
-			, m_pBaseBitmap(nullptr)
-			, m_pLastBitmap(nullptr)
+			, m_pView(nullptr)
+			, m_pSeekLatency(new LatencyHistogram())
+			, m_pViewLock(gcnew Object())
+			, m_pDisplayBitmaps(gcnew array<Bitmap^>(2))
+			, m_DisplayIndex(0)
 		{
 			InitializeComponent();
 			this->m_pTrackBar->Enabled = false;
@@ -50,126 +54,182 @@ namespace place_gui
 			m_pPictureBox->Image = image;
 			m_pTrackBar->Enabled = true;
 			m_pTrackBar->Minimum = 0;
-			m_pTrackBar->Maximum = static_cast<int>(m_pForwardDiffData->size());
 			saveCurrentFrameToolStripMenuItem->Enabled = true;
 		}
 
+		void UpdateStepCount(int step_count)
+		{
+			m_pTrackBar->Maximum = step_count - 1;
+		}
+
 		// Thread function
+		// the archive is streamed: every block read extends the timeline and the view, the first
+		// frame is shown and the track bar enabled as soon as the first step is complete, and the
+		// track bar grows with the steps loaded after it
 		void LoadPlaceDiffsFile(System::Object^ threadParam)
 		{
 			DiffLoadThreadParam^ param = (DiffLoadThreadParam^) threadParam;
-			std::ifstream diffs_file(*param->m_file_path, std::ios::in | std::ios::binary);
-			if (param->m_pDiffData != nullptr && diffs_file.is_open())
-			{
-				PlaceDiff diff;
-				uint32_t timestamp = 0;
+			Control::Invoke(gcnew Action<String^>(this, &PlaceVisualizerForm::UpdateStatusLabel), "Loading diff file...");
 
-				auto file_start = diffs_file.tellg();
-				diffs_file.seekg(0, std::ios::end);
-				auto file_end = diffs_file.tellg();
-				diffs_file.seekg(0, std::ios::beg);
-				double file_length = static_cast<double>(file_end - file_start);
+			if (param->m_pArchive != nullptr && param->m_pArchive->Open(*param->m_file_path, DiffArchive::LoadMode::Streamed))
+			{
+				// records off the canvas are dropped as the blocks arrive, nothing after this checks them
+				param->m_pArchive->Validate(param->m_pView->Width(), param->m_pView->Height(), param->m_pView->PaletteSize());
+				{
+					msclr::lock view_lock(m_pViewLock);
+					param->m_pTimeline->Start(*param->m_pArchive);
+					param->m_pView->Start(*param->m_pTimeline);
+				}
 
-				uint32_t count = 0;
-				while (!diffs_file.eof())
+				bool shown = false;
+				bool failed = false;
+				bool complete = param->m_pArchive->Complete();
+				for (;;)
 				{
-					if (++count % 100000 == 0)
+					// the block is read without the lock, the ui keeps scrubbing the steps it already has
+					if (!complete)
 					{
-						int progress = static_cast<int>(((diffs_file.tellg() - file_start) / file_length) * 100.0);
-						Control::Invoke(gcnew Action<String^>(this, &PlaceVisualizerForm::UpdateStatusLabel), "Loading diff file (" + progress + "%)");
+						failed = !param->m_pArchive->ReadNext();
+						complete = failed || param->m_pArchive->Complete();
 					}
 
-					diffs_file.read(reinterpret_cast<char*>(&diff), sizeof(diff));
-					if (diff.timestamp != timestamp)
+					uint64_t step_count = 0;
 					{
-						param->m_pDiffData->resize(param->m_pDiffData->size() + 1);
-						timestamp = diff.timestamp;
-					}
-					param->m_pDiffData->back().push_back(diff);
-				}
+						msclr::lock view_lock(m_pViewLock);
+						if (param->m_pTimeline->Extend(param->m_pArchive->Loaded(), complete) > 0)
+							param->m_pView->Extend();
+						step_count = param->m_pTimeline->StepCount();
 
-				diffs_file.close();
-				if (param->m_pDiffData->size() > 0)
-				{
-					Control::Invoke(gcnew Action<String^>(this, &PlaceVisualizerForm::UpdateStatusLabel), "Diff file loaded successfully");
-					param->m_pBaseBitmap = new BitMapCore(1000, 1000);
-					if (m_pForwardDiffData->size() > 0)
-					{
-						if (m_pForwardDiffData->at(0).size() > 0)
+						if (!shown && step_count > 0 && !param->m_pTimeline->Step(0).empty())
 						{
-							const auto& diff_step = m_pForwardDiffData->at(0);
-							param->m_pBaseBitmap->Update(diff_step);
-							auto image_data = param->m_pBaseBitmap->GenerateBMPData();
+							param->m_pView->SeekTo(1);
+							const auto& image_data = param->m_pView->GenerateBMPData();
 							array<Byte>^ pBaseImage = gcnew array<Byte>(static_cast<int>(image_data.size()));
 							Marshal::Copy((IntPtr)image_data.data(), pBaseImage, 0, static_cast<int>(image_data.size()));
 							MemoryStream^ ms = gcnew MemoryStream(pBaseImage);
 							Image^ pImage = Bitmap::FromStream(ms);
+							view_lock.release();
 							Control::Invoke(gcnew Action<Image^>(this, &PlaceVisualizerForm::LoadThreadComplete), gcnew Bitmap(pImage));
+							shown = true;
 						}
 					}
-					*param->m_pLastBitmap = BitMapCore(*param->m_pBaseBitmap);
+
+					if (step_count > 0)
+						Control::Invoke(gcnew Action<int>(this, &PlaceVisualizerForm::UpdateStepCount), static_cast<int>(step_count));
+					if (complete)
+						break;
+
+					Control::Invoke(gcnew Action<String^>(this, &PlaceVisualizerForm::UpdateStatusLabel),
+						String::Format("Loading diff file... {0} steps", step_count));
 				}
+
+				const DiffValidationReport& report = param->m_pArchive->Report();
+				String^ status = failed ? "Failed to read the whole diff file" : "Diff file loaded successfully";
+				if (!report.Clean())
+					status = String::Format("{0}, {1} records off the canvas dropped, {2} colors outside the palette drawn white",
+						status, report.out_of_range, report.invalid_colors);
+				Control::Invoke(gcnew Action<String^>(this, &PlaceVisualizerForm::UpdateStatusLabel), status);
+			}
+			else
+			{
+				Control::Invoke(gcnew Action<String^>(this, &PlaceVisualizerForm::UpdateStatusLabel), "Failed to open diff file");
 			}
 		}
 
 		void LoadPlaceDiffs(const std::string& file_path)
 		{
+			if (m_pView != nullptr)
+				delete m_pView;
 			if (m_pForwardDiffData != nullptr)
 				delete m_pForwardDiffData;
-			if (m_pBaseBitmap != nullptr)
-				delete m_pBaseBitmap;
-			if (m_pLastBitmap != nullptr)
-				delete m_pLastBitmap;
+			if (m_pArchive != nullptr)
+				delete m_pArchive;
 
 			System::Threading::Thread^ pLoadThread = 
 				gcnew System::Threading::Thread(
 					gcnew System::Threading::ParameterizedThreadStart(
 						this, &PlaceVisualizerForm::LoadPlaceDiffsFile));
 
-			m_pBaseBitmap = new BitMapCore(1000, 1000);
-			m_pLastBitmap = new BitMapCore(1000, 1000);
-			m_pForwardDiffData = new std::vector<std::vector<PlaceDiff>>();			
-			pLoadThread->Start(gcnew DiffLoadThreadParam(file_path, m_pForwardDiffData, m_pBaseBitmap, m_pLastBitmap));
+			// the canvas size and palette only need the archive's header or sidecar, the view is sized before loading
+			CanvasFormat format;
+			m_pView = format.Load(file_path) ? PlaceView::Create(format).release() : nullptr;
+			if (m_pView == nullptr)
+			{
+				m_pArchive = nullptr;
+				m_pForwardDiffData = nullptr;
+				m_pTrackBar->Enabled = false;
+				UpdateStatusLabel("Failed to read the canvas size and palette");
+				return;
+			}
+			m_pView->EnablePyramid();
+			m_pArchive = new DiffArchive();
+			m_pForwardDiffData = new DiffTimeline();
+			m_pSeekLatency->Clear();
+			pLoadThread->Start(gcnew DiffLoadThreadParam(file_path, m_pArchive, m_pForwardDiffData, m_pView));
 		}
 
 		void UpdatePlaceImage(int step)
 		{
 			if (m_pForwardDiffData == nullptr)
 				return;
-			if (m_pBaseBitmap == nullptr)
-				return;
-			if (m_pLastBitmap == nullptr)
+			if (m_pView == nullptr || !m_pView->Ready())
 				return;
 
+			// the loader thread may be extending the timeline and the view
+			msclr::lock view_lock(m_pViewLock);
 			size_t diff_index = step;
-			if (m_pForwardDiffData->size() > diff_index)
+			if (m_pForwardDiffData->StepCount() > diff_index)
 			{
-				// start with last bitmap that was drawn
-				size_t start_idx = (diff_index > m_LastBitmapIndex) ? m_LastBitmapIndex + 1 : 0;
-				BitMapCore* pNewBitmap = new BitMapCore(start_idx == 0 ? *m_pBaseBitmap : *m_pLastBitmap);
-				m_pProgressLabel->Text = step + " / " + m_pForwardDiffData->size();
+				Diagnostics::Stopwatch^ seek_timer = Diagnostics::Stopwatch::StartNew();
 
-				for (size_t i = start_idx; i < diff_index; ++i)
-				{
-					// play back any diff data since the last step drawn
-					const std::vector<PlaceDiff>& diff_step = m_pForwardDiffData->at(i);
-					pNewBitmap->Update(diff_step);
-				}
+				// the bitmap drawn for step i has steps [0, i] applied. the cursor plays diffs
+				// forwards, undoes them backwards or restarts from a keyframe, whichever is cheapest
+				m_pView->SeekTo(diff_index + 1);
+
+				// the picture box shrinks the image anyway, hand it the smallest pyramid level that still covers it
+				const int box_size = (std::max)(m_pPictureBox->Width, m_pPictureBox->Height);
+				uint32_t level = 0;
+				const int canvas_size = (std::max)(m_pView->Width(), m_pView->Height());
+				while (level + 1 < MipPyramid::level_count && (canvas_size >> (level + 1)) >= box_size)
+					++level;
+
+				PresentFrame(m_pView->GenerateBMPData(level));
 
-				auto image_data = pNewBitmap->GenerateBMPData();
-				array<Byte>^ pImageData = gcnew array<Byte>(static_cast<int>(image_data.size()));
-				Marshal::Copy((IntPtr)image_data.data(), pImageData, 0, static_cast<int>(image_data.size()));
-				MemoryStream^ ms = gcnew MemoryStream(pImageData);
-				Image^ pNewImage = Bitmap::FromStream(ms);
-				m_pPictureBox->Image = pNewImage;
-				m_LastBitmapIndex = diff_index;
-
-				if (m_pLastBitmap != nullptr)
-					delete m_pLastBitmap;
-				m_pLastBitmap = pNewBitmap;
+				m_pSeekLatency->Record(seek_timer->Elapsed.TotalMilliseconds);
+				m_pProgressLabel->Text = String::Format("{0} / {1}  (seek p50 {2:F1} ms, p99 {3:F1} ms)",
+					step, m_pForwardDiffData->StepCount() - 1, m_pSeekLatency->Percentile(50.0), m_pSeekLatency->Percentile(99.0));
 			}
 		}
 
+		// two display bitmaps: the encoded frame's rows are copied into the one not on screen,
+		// which is then shown. once both match the frame size scrubbing allocates no images
+		void PresentFrame(const std::vector<char>& image_data)
+		{
+			const BitMapInfoHeader& info = *reinterpret_cast<const BitMapInfoHeader*>(image_data.data() + sizeof(BitMapFileHeader));
+			const int32_t width = info.Width();
+			const int32_t height = info.Height();
+			const size_t row_bytes = static_cast<size_t>(width) * sizeof(BitMapColor);
+			const size_t stride = row_bytes + (4 - (row_bytes % 4)) % 4;
+			const char* pixels = image_data.data() + sizeof(BitMapFileHeader) + sizeof(BitMapInfoHeader);
+
+			m_DisplayIndex ^= 1;
+			Bitmap^ pTarget = m_pDisplayBitmaps[m_DisplayIndex];
+			if (pTarget == nullptr || pTarget->Width != width || pTarget->Height != height)
+			{
+				pTarget = gcnew Bitmap(width, height, PixelFormat::Format24bppRgb);
+				m_pDisplayBitmaps[m_DisplayIndex] = pTarget;
+			}
+
+			// both store BGR rows padded to 4 bytes, the .bmp bottom row first
+			BitmapData^ pLocked = pTarget->LockBits(System::Drawing::Rectangle(0, 0, width, height), ImageLockMode::WriteOnly, PixelFormat::Format24bppRgb);
+			char* dest = static_cast<char*>(pLocked->Scan0.ToPointer());
+			for (int32_t row = 0; row < height; ++row)
+				std::copy(pixels + (height - 1 - row) * stride, pixels + (height - 1 - row) * stride + row_bytes, dest + row * pLocked->Stride);
+			pTarget->UnlockBits(pLocked);
+
+			m_pPictureBox->Image = pTarget;
+		}
+
 	protected:
 		~PlaceVisualizerForm()
 		{
@@ -203,7 +263,7 @@ namespace place_gui
 			if (fd.ShowDialog() == System::Windows::Forms::DialogResult::OK)
 			{
 				std::string file_path = marshal_as<std::string>(fd.FileName);
-				m_pLastBitmap->Write(file_path);
+				m_pView->Write(file_path);
 			}
 		}
 
@@ -221,11 +281,13 @@ namespace place_gui
 		// Required designer variable.
 		System::ComponentModel::Container^			components;
 
-		std::vector<std::vector<PlaceDiff>>*		m_pForwardDiffData;
-		std::vector<std::vector<PlaceDiff>>*		m_pReverseDiffData;
-		BitMapCore*									m_pBaseBitmap;
-		BitMapCore*									m_pLastBitmap;
-		size_t										m_LastBitmapIndex;
+		DiffArchive*								m_pArchive;
+		DiffTimeline*								m_pForwardDiffData;
+		PlaceView*									m_pView;
+		LatencyHistogram*							m_pSeekLatency;
+		Object^										m_pViewLock;
+		array<Bitmap^>^								m_pDisplayBitmaps;
+		int											m_DisplayIndex;
 
 #pragma region Windows Form Designer generated code
 		// Required method for Designer support - do not modify